@@ -0,0 +1,74 @@
+#include "AggregateTable.h"
+#include <cstdint>
+
+// Slots of a new table, a power of two.
+static const int INITIAL_BITS = 4;
+
+AggregateTable::AggregateTable()
+ : count(0)
+ , bits(0)
+{ }
+
+
+AggregateTable::Entry *AggregateTable::find(K2 *key, std::size_t hash, bool *inserted)
+{
+	// Keeps the table at most half full.
+	if (2 * (count + 1) > entries.size()) {
+		grow();
+	}
+	std::size_t slot = hashSlot(hash, bits);
+	bool equal = false;
+	while (entries[slot].key != nullptr) {
+		if (entries[slot].hash == hash) {
+			if (key->equals(*entries[slot].key, equal) && equal) {
+				*inserted = false;
+				return &entries[slot];
+			}
+		}
+		slot = (slot + 1) & (entries.size() - 1);
+	}
+	entries[slot].hash = hash;
+	entries[slot].key = key;
+	entries[slot].partial = nullptr;
+	count++;
+	*inserted = true;
+	return &entries[slot];
+}
+
+
+std::size_t AggregateTable::size() const
+{
+	return count;
+}
+
+
+std::vector<AggregateTable::Entry> &AggregateTable::slots()
+{
+	return entries;
+}
+
+
+void AggregateTable::clear()
+{
+	std::vector<Entry>().swap(entries);
+	count = 0;
+	bits = 0;
+}
+
+
+void AggregateTable::grow()
+{
+	std::vector<Entry> old;
+	old.swap(entries);
+	bits = bits == 0 ? INITIAL_BITS : bits + 1;
+	entries.assign((std::size_t) 1 << bits, Entry{0, nullptr, nullptr});
+	for (const Entry &entry : old) {
+		if (entry.key != nullptr) {
+			std::size_t slot = hashSlot(entry.hash, bits);
+			while (entries[slot].key != nullptr) {
+				slot = (slot + 1) & (entries.size() - 1);
+			}
+			entries[slot] = entry;
+		}
+	}
+}
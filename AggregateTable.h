@@ -0,0 +1,45 @@
+#ifndef AGGREGATETABLE_H
+#define AGGREGATETABLE_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MapReduceClient.h"
+
+// multiplier spreading key hashes over a table, 2^64 divided by the golden ratio.
+static const uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+
+// home slot of a hash in an open addressing table of 2^bits slots, bits above 0.
+inline std::size_t hashSlot(std::size_t hash, int bits) {
+	return (std::size_t) ((hash * HASH_MULTIPLIER) >> (64 - bits));
+}
+
+// an open addressing hash table of keys and their partial results, for aggregating clients.
+// keys must implement K2::hash and K2::equals.
+
+class AggregateTable {
+public:
+	typedef struct {
+		std::size_t hash;
+		// nullptr in an empty slot.
+		K2 *key;
+		void *partial;
+	} Entry;
+
+	AggregateTable();
+	// the entry of the key. a new key is inserted with a null partial, and inserted is set.
+	Entry *find(K2 *key, std::size_t hash, bool *inserted);
+	std::size_t size() const;
+	// all slots, the empty ones included.
+	std::vector<Entry> &slots();
+	// drops every entry, without releasing keys or partials.
+	void clear();
+
+private:
+	void grow();
+
+	std::vector<Entry> entries;
+	std::size_t count;
+	int bits;
+};
+
+#endif //AGGREGATETABLE_H
@@ -0,0 +1,55 @@
+#include "Arena.h"
+#include <cstdlib>
+#include <cstdio>
+
+// Bytes in a block, larger allocations get a block of their own.
+static const std::size_t BLOCK_SIZE = 64 * 1024;
+// Alignment of every allocation.
+static const std::size_t ALIGNMENT = alignof(std::max_align_t);
+
+Arena::Arena()
+ : curr(nullptr)
+ , left(0)
+{ }
+
+
+Arena::~Arena()
+{
+	for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+		it->second(it->first);
+	}
+	for (char *block : blocks) {
+		free(block);
+	}
+}
+
+
+void *Arena::allocate(std::size_t size)
+{
+	size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	if (size > left) {
+		std::size_t blockSize = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+		char *block = (char *) malloc(blockSize);
+		if (block == nullptr) {
+			fprintf(stderr, "[[Arena]] error on malloc");
+			exit(1);
+		}
+		blocks.push_back(block);
+		if (blockSize > BLOCK_SIZE) {
+			// Keeps bumping the current block, the big allocation has its own.
+			return block;
+		}
+		curr = block;
+		left = blockSize;
+	}
+	void *object = curr;
+	curr += size;
+	left -= size;
+	return object;
+}
+
+
+void Arena::atFree(void *object, void (*destroy)(void *))
+{
+	destructors.push_back(std::make_pair(object, destroy));
+}
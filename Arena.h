@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// a bump allocator freed all at once, one per thread of a job
+
+class Arena {
+public:
+	Arena();
+	~Arena();
+	// memory is aligned for any fundamental type.
+	void *allocate(std::size_t size);
+	// runs destroy(object) when the arena is freed, in reverse order of registration.
+	void atFree(void *object, void (*destroy)(void *));
+
+private:
+	std::vector<char *> blocks;
+	char *curr;
+	std::size_t left;
+	std::vector<std::pair<void *, void (*)(void *)> > destructors;
+};
+
+#endif //ARENA_H
@@ -0,0 +1,131 @@
+#include "GroupQueue.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex words must be plain ints");
+
+GroupQueue::GroupQueue(unsigned long capacity, int producers)
+ : enqueuePos(0)
+ , dequeuePos(0)
+ , producers(producers)
+ , events(0)
+ , sleepers(0)
+{
+	unsigned long size = 2;
+	while (size < capacity) {
+		size *= 2;
+	}
+	cells = new Cell[size];
+	mask = size - 1;
+	for (unsigned long i = 0; i < size; ++i) {
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+
+GroupQueue::~GroupQueue()
+{
+	delete[] cells;
+}
+
+
+bool GroupQueue::push(const QueuedGroup &group)
+{
+	unsigned long pos = enqueuePos.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &cells[pos & mask];
+		long diff = (long) (cell->sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// The cell still holds the group of the previous lap.
+			return false;
+		} else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+	cell->group = group;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	notify(1);
+	return true;
+}
+
+
+bool GroupQueue::tryPop(QueuedGroup *group)
+{
+	unsigned long pos = dequeuePos.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &cells[pos & mask];
+		long diff = (long) (cell->sequence.load(std::memory_order_acquire) - (pos + 1));
+		if (diff == 0) {
+			if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = dequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+	*group = cell->group;
+	// Frees the cell for the next lap.
+	cell->sequence.store(pos + mask + 1, std::memory_order_release);
+	return true;
+}
+
+
+bool GroupQueue::pop(QueuedGroup *group)
+{
+	while (true) {
+		int seen = events.load();
+		if (tryPop(group)) {
+			return true;
+		}
+		if (producers.load() == 0) {
+			// Groups pushed before the last producer left are visible by now.
+			return tryPop(group);
+		}
+		sleepers.fetch_add(1);
+		// Returns right away if anything happened since seen was read.
+		if (syscall(SYS_futex, (int *) &events, FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0) != 0 &&
+			errno != EAGAIN && errno != EINTR) {
+			fprintf(stderr, "[[GroupQueue]] error on futex wait");
+			exit(1);
+		}
+		sleepers.fetch_sub(1);
+	}
+}
+
+
+void GroupQueue::addProducer()
+{
+	producers.fetch_add(1);
+}
+
+
+void GroupQueue::removeProducer()
+{
+	producers.fetch_sub(1);
+	// Consumers waiting on the last producer stop waiting.
+	notify(INT_MAX);
+}
+
+
+void GroupQueue::notify(int count)
+{
+	events.fetch_add(1);
+	if (sleepers.load() > 0 &&
+		syscall(SYS_futex, (int *) &events, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0) < 0) {
+		fprintf(stderr, "[[GroupQueue]] error on futex wake");
+		exit(1);
+	}
+}
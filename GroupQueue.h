@@ -0,0 +1,59 @@
+#ifndef GROUPQUEUE_H
+#define GROUPQUEUE_H
+#include <atomic>
+#include "MapReduceClient.h"
+
+// a bounded multi-producer multi-consumer queue of groups, handed from shuffling
+// threads to the reducers. pushing and popping take no lock, consumers waiting for
+// groups sleep on a futex.
+
+typedef struct {
+	const IntermediatePair *begin;
+	const IntermediatePair *end;
+	// vector holding the pairs, deleted once they are reduced. nullptr for groups
+	// viewed in place in a buffer that outlives the queue.
+	IntermediateVec *owner;
+} QueuedGroup;
+
+class GroupQueue {
+public:
+	// capacity is rounded up to a power of two. producers is how many producers
+	// are pushing already, more may join with addProducer.
+	GroupQueue(unsigned long capacity, int producers);
+	~GroupQueue();
+	// returns false, without queueing the group, if the queue is full.
+	bool push(const QueuedGroup &group);
+	// blocks while the queue is empty and some producer is pushing. returns false
+	// once the queue is empty and no producer is.
+	bool pop(QueuedGroup *group);
+	// returns false if the queue is empty.
+	bool tryPop(QueuedGroup *group);
+	void addProducer();
+	// the producer will push no more groups.
+	void removeProducer();
+
+private:
+	// bumps events and wakes up to count waiting consumers.
+	void notify(int count);
+
+	typedef struct {
+		// which lap of the ring the cell is on, and whether it holds a group.
+		std::atomic<unsigned long> sequence;
+		QueuedGroup group;
+	} Cell;
+
+	Cell *cells;
+	unsigned long mask;
+	// keeps the producers' and the consumers' positions off each other's cache lines.
+	char cellsPadding[64];
+	std::atomic<unsigned long> enqueuePos;
+	char enqueuePadding[64];
+	std::atomic<unsigned long> dequeuePos;
+	char dequeuePadding[64];
+	std::atomic<int> producers;
+	// bumped on every push and every producer leaving, the futex consumers sleep on.
+	std::atomic<int> events;
+	std::atomic<int> sleepers;
+};
+
+#endif //GROUPQUEUE_H
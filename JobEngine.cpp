@@ -0,0 +1,561 @@
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "JobEngine.h"
+#include "RangeDeque.h"
+
+// Smallest number of items a thread claims at once.
+static const unsigned long MIN_CLAIM_SIZE = 1;
+// Work ranges are split down to this many grains per thread.
+static const unsigned long GRAINS_PER_THREAD = 64;
+// Least run time between two checks whether a worker should go to another job, in nanoseconds.
+static const uint64_t YIELD_CHECK_NS = 1000000;
+
+struct EngineJob;
+
+/**
+ * @brief One thread's part of a stage of a job, the unit the pool's workers run.
+ */
+typedef struct EngineTask
+{
+	EngineJob *job;
+	int stage;
+	// Thread of the job the part runs as, whichever worker runs it.
+	int threadNum;
+	// Time up to which the part's run time is charged to its job, in nanoseconds.
+	uint64_t chargedAt;
+} EngineTask;
+
+// Task the calling worker runs, nullptr on other threads.
+static thread_local EngineTask *currentTask = nullptr;
+
+/**
+ * @brief Process-wide workers, one per core, running the tasks of every job.
+ */
+typedef struct WorkerPool
+{
+	// Guards the pool and the scheduling fields of its jobs.
+	pthread_mutex_t mutex;
+	// Signalled when tasks become ready.
+	pthread_cond_t notEmpty;
+	// Jobs with parts of their current stage ready to run.
+	std::vector<EngineJob *> readyJobs;
+	// Sum of the weights of the jobs not done yet.
+	unsigned long activeWeight;
+	// Pass of the latest job handed a worker. New jobs start from it, so they run soon but can't
+	// claim turns for the time before they started.
+	uint64_t virtualTime;
+	std::vector<pthread_t> workers;
+} WorkerPool;
+
+static WorkerPool *pool = nullptr;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief A running parallel task. Its stages form a chain of task groups: the threadCount parts of a
+ * stage are ready together, and finishStage runs once all of them are done.
+ */
+typedef struct EngineJob
+{
+	// Stages the workers run.
+	ParallelTask *task;
+	// Number of parts each stage runs as.
+	int threadCount;
+	// Parts of the current stage not done yet.
+	std::atomic<int> pendingTasks;
+	// Share of the workers relative to other jobs, at least 1.
+	unsigned int weight;
+	// Stage being run, and its next part to hand to a worker. Guarded by the pool.
+	int stage;
+	int nextPart;
+	// Parts running on workers right now. Guarded by the pool.
+	int running;
+	// Run time of the job's parts in nanoseconds, divided by its weight. The job with the lowest
+	// pass runs next. Guarded by the pool.
+	uint64_t pass;
+	// Guards done and eventFd.
+	pthread_mutex_t doneMutex;
+	// Signalled once the job is done.
+	pthread_cond_t doneCond;
+	// Whether the task ran all its stages.
+	bool done;
+	// Descriptor that becomes readable once the job is done, -1 until asked for.
+	int eventFd;
+
+	// Ctor.
+	EngineJob(ParallelTask *_task, int _threadCount, unsigned int _weight) :
+			task(_task), threadCount(_threadCount), pendingTasks(0), weight(std::max(1U, _weight)), stage(0),
+			nextPart(0), running(0), pass(0), doneMutex(PTHREAD_MUTEX_INITIALIZER), done(false), eventFd(-1)
+	{
+		// Timed waits measure against the monotonic clock.
+		pthread_condattr_t condAttr;
+		if (pthread_condattr_init(&condAttr) != 0 ||
+			pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC) != 0 ||
+			pthread_cond_init(&doneCond, &condAttr) != 0 ||
+			pthread_condattr_destroy(&condAttr) != 0)
+		{
+			fprintf(stderr, "EngineJob: error on pthread_cond_init");
+			exit(1);
+		}
+	}
+
+	~EngineJob()
+	{
+		delete task;
+		if (eventFd != -1)
+		{
+			close(eventFd);
+		}
+		if (pthread_cond_destroy(&doneCond) != 0 || pthread_mutex_destroy(&doneMutex) != 0)
+		{
+			fprintf(stderr, "EngineJob: error on pthread_cond_destroy");
+			exit(1);
+		}
+	}
+} EngineJob;
+
+/**
+ * @brief Marks the job as done and wakes everyone waiting on it.
+ */
+void finishJob(EngineJob *job)
+{
+	if (pthread_mutex_lock(&job->doneMutex) != 0)
+	{
+		fprintf(stderr, "Finish: error on pthread_mutex_lock");
+		exit(1);
+	}
+	job->done = true;
+	if (job->eventFd != -1 && eventfd_write(job->eventFd, 1) != 0)
+	{
+		fprintf(stderr, "Finish: error on eventfd_write");
+		exit(1);
+	}
+	if (pthread_cond_broadcast(&job->doneCond) != 0)
+	{
+		fprintf(stderr, "Finish: error on pthread_cond_broadcast");
+		exit(1);
+	}
+	if (pthread_mutex_unlock(&job->doneMutex) != 0)
+	{
+		fprintf(stderr, "Finish: error on pthread_mutex_unlock");
+		exit(1);
+	}
+}
+
+void lockPool()
+{
+	if (pthread_mutex_lock(&pool->mutex) != 0)
+	{
+		fprintf(stderr, "Pool: error on pthread_mutex_lock");
+		exit(1);
+	}
+}
+
+void unlockPool()
+{
+	if (pthread_mutex_unlock(&pool->mutex) != 0)
+	{
+		fprintf(stderr, "Pool: error on pthread_mutex_unlock");
+		exit(1);
+	}
+}
+
+/**
+ * @brief Makes the parts of a stage of the job ready. Part 0 is handed out first: some stages have
+ * the other parts wait on what it produces, and it never waits on them.
+ */
+void submitStage(EngineJob *job, int stage)
+{
+	job->pendingTasks.store(job->threadCount);
+	lockPool();
+	job->stage = stage;
+	job->nextPart = 0;
+	pool->readyJobs.push_back(job);
+	if (pthread_cond_broadcast(&pool->notEmpty) != 0)
+	{
+		fprintf(stderr, "Submit: error on pthread_cond_broadcast");
+		exit(1);
+	}
+	unlockPool();
+}
+
+// Monotonic time in nanoseconds.
+uint64_t nowNs()
+{
+	timespec now{};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief Adds the time the task ran since it was last charged to its job's pass, with the pool locked.
+ */
+void chargeTask(EngineTask *task)
+{
+	uint64_t now = nowNs();
+	task->job->pass += (now - task->chargedAt) / task->job->weight;
+	task->chargedAt = now;
+}
+
+/**
+ * @brief Index of the ready job the next worker goes to, with the pool locked and jobs ready. Each
+ * job is granted workers in proportion to its weight: jobs running fewer parts than their share go
+ * first, and among them the job with the lowest pass, so over time jobs get run time in proportion
+ * to their weights. Jobs over their share still get idle workers.
+ */
+unsigned long pickJob()
+{
+	unsigned long best = 0;
+	bool bestUnderShare = false;
+	for (unsigned long i = 0; i < pool->readyJobs.size(); ++i)
+	{
+		EngineJob *job = pool->readyJobs[i];
+		unsigned long share = std::max(1UL, pool->workers.size() * job->weight / pool->activeWeight);
+		bool underShare = (unsigned long) job->running < share;
+		if (i == 0 || (underShare && !bestUnderShare) ||
+			(underShare == bestUnderShare && job->pass < pool->readyJobs[best]->pass))
+		{
+			best = i;
+			bestUnderShare = underShare;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Hands out the next part of the job pickJob picks, with the pool locked and jobs ready.
+ */
+EngineTask nextTask()
+{
+	unsigned long best = pickJob();
+	EngineJob *job = pool->readyJobs[best];
+	EngineTask task = {job, job->stage, job->nextPart++, nowNs()};
+	job->running++;
+	pool->virtualTime = std::max(pool->virtualTime, job->pass);
+	if (job->nextPart == job->threadCount)
+	{
+		pool->readyJobs.erase(pool->readyJobs.begin() + best);
+	}
+	return task;
+}
+
+/**
+ * @brief Whether the calling worker should leave its part for another job, which pickJob prefers.
+ * Only parts whose stage has parts not started yet leave: those finish the stage's work.
+ */
+bool shouldYield()
+{
+	EngineTask *task = currentTask;
+	if (task == nullptr || nowNs() - task->chargedAt < YIELD_CHECK_NS)
+	{
+		return false;
+	}
+	lockPool();
+	chargeTask(task);
+	EngineJob *job = task->job;
+	// Picks as if the worker were free.
+	job->running--;
+	bool yield = job->nextPart < job->threadCount && pool->readyJobs[pickJob()] != job;
+	job->running++;
+	unlockPool();
+	return yield;
+}
+
+/**
+ * @brief Runs a part of a stage. The worker finishing the last part of the stage runs finishStage
+ * and makes the next stage ready, or finishes the job.
+ */
+void runTask(EngineTask task)
+{
+	EngineJob *job = task.job;
+	currentTask = &task;
+	job->task->runStage(task.stage, task.threadNum);
+	currentTask = nullptr;
+	lockPool();
+	chargeTask(&task);
+	job->running--;
+	unlockPool();
+	if (job->pendingTasks.fetch_sub(1) == 1)
+	{
+		int next = job->task->finishStage(task.stage);
+		if (next == JOB_DONE)
+		{
+			lockPool();
+			pool->activeWeight -= job->weight;
+			unlockPool();
+			// The job may be deleted as soon as it is done.
+			finishJob(job);
+		}
+		else
+		{
+			submitStage(job, next);
+		}
+	}
+}
+
+/**
+ * @brief The main function of each worker: runs ready tasks of any job, forever.
+ */
+void *runWorker(void *)
+{
+	while (true)
+	{
+		lockPool();
+		while (pool->readyJobs.empty())
+		{
+			if (pthread_cond_wait(&pool->notEmpty, &pool->mutex) != 0)
+			{
+				fprintf(stderr, "Worker: error on pthread_cond_wait");
+				exit(1);
+			}
+		}
+		EngineTask task = nextTask();
+		unlockPool();
+		runTask(task);
+	}
+	return nullptr;
+}
+
+/**
+ * @brief Starts the workers, once per process. They live until the process exits.
+ */
+void startPool()
+{
+	pool = new WorkerPool();
+	pool->mutex = PTHREAD_MUTEX_INITIALIZER;
+	pool->notEmpty = PTHREAD_COND_INITIALIZER;
+	pool->activeWeight = 0;
+	pool->virtualTime = 0;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	pool->workers.resize((unsigned long) std::max(1L, cores));
+	for (pthread_t &worker:pool->workers)
+	{
+		if (pthread_create(&worker, nullptr, runWorker, nullptr) != 0)
+		{
+			fprintf(stderr, "Pool: error on pthread_create");
+			exit(1);
+		}
+		pthread_detach(worker);
+	}
+}
+
+JobHandle startParallelJob(ParallelTask *task, int multiThreadLevel)
+{
+	return startParallelJob(task, multiThreadLevel, 1);
+}
+
+JobHandle startParallelJob(ParallelTask *task, int multiThreadLevel, unsigned int weight)
+{
+	pthread_once(&poolOnce, startPool);
+	auto *job = new EngineJob(task, multiThreadLevel, weight);
+	lockPool();
+	job->pass = pool->virtualTime;
+	pool->activeWeight += job->weight;
+	unlockPool();
+	submitStage(job, 0);
+	return job;
+}
+
+WorkRanges::WorkRanges(unsigned long size, int threadCount) :
+		grain(std::max(MIN_CLAIM_SIZE, size / (GRAINS_PER_THREAD * threadCount)))
+{
+	for (int i = 0; i < threadCount; ++i)
+	{
+		deques.push_back(new RangeDeque());
+		unsigned long start = size * i / threadCount;
+		unsigned long end = size * (i + 1) / threadCount;
+		if (start < end)
+		{
+			deques.back()->push(start, end);
+		}
+	}
+}
+
+WorkRanges::~WorkRanges()
+{
+	for (RangeDeque *deque:deques)
+	{
+		delete deque;
+	}
+}
+
+bool WorkRanges::claim(int threadNum, unsigned long *start, unsigned long *end)
+{
+	if (shouldYield())
+	{
+		return false;
+	}
+	RangeDeque *own = deques[threadNum];
+	if (!own->pop(start, end) && !steal(threadNum, start, end))
+	{
+		return false;
+	}
+	while (*end - *start > grain)
+	{
+		unsigned long middle = *start + (*end - *start) / 2;
+		own->push(middle, *end);
+		*end = middle;
+	}
+	return true;
+}
+
+/**
+ * @brief Steals a range from the other threads, starting at a random one. Gives up once all of them
+ * are seen empty in one round, retries rounds where a range was lost to another thief.
+ */
+bool WorkRanges::steal(int threadNum, unsigned long *start, unsigned long *end)
+{
+	// Xorshift state of the calling thread.
+	static thread_local uint64_t seed = 0;
+	if (seed == 0)
+	{
+		seed = (nowNs() + (uint64_t) threadNum * 0x9E3779B97F4A7C15ULL) | 1;
+	}
+	bool allEmpty = false;
+	while (!allEmpty)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		allEmpty = true;
+		for (unsigned long i = 0; i < deques.size(); ++i)
+		{
+			unsigned long victim = (seed + i) % deques.size();
+			bool empty;
+			if (victim == (unsigned long) threadNum)
+			{
+				continue;
+			}
+			if (deques[victim]->steal(start, end, &empty))
+			{
+				return true;
+			}
+			allEmpty = allEmpty && empty;
+		}
+	}
+	return false;
+}
+
+void waitForJob(JobHandle job)
+{
+	auto *engineJob = (EngineJob *) job;
+	if (pthread_mutex_lock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "Wait: error on pthread_mutex_lock");
+		exit(1);
+	}
+	while (!engineJob->done)
+	{
+		if (pthread_cond_wait(&engineJob->doneCond, &engineJob->doneMutex) != 0)
+		{
+			fprintf(stderr, "Wait: error on pthread_cond_wait");
+			exit(1);
+		}
+	}
+	if (pthread_mutex_unlock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "Wait: error on pthread_mutex_unlock");
+		exit(1);
+	}
+}
+
+bool waitForJobFor(JobHandle job, unsigned int timeoutMs)
+{
+	auto *engineJob = (EngineJob *) job;
+	timespec deadline{};
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	if (pthread_mutex_lock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "Wait: error on pthread_mutex_lock");
+		exit(1);
+	}
+	int res = 0;
+	while (!engineJob->done && res != ETIMEDOUT)
+	{
+		res = pthread_cond_timedwait(&engineJob->doneCond, &engineJob->doneMutex, &deadline);
+		if (res != 0 && res != ETIMEDOUT)
+		{
+			fprintf(stderr, "Wait: error on pthread_cond_timedwait");
+			exit(1);
+		}
+	}
+	bool done = engineJob->done;
+	if (pthread_mutex_unlock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "Wait: error on pthread_mutex_unlock");
+		exit(1);
+	}
+	return done;
+}
+
+int getJobEventFd(JobHandle job)
+{
+	auto *engineJob = (EngineJob *) job;
+	if (pthread_mutex_lock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "EventFd: error on pthread_mutex_lock");
+		exit(1);
+	}
+	if (engineJob->eventFd == -1)
+	{
+		engineJob->eventFd = eventfd(engineJob->done ? 1 : 0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (engineJob->eventFd == -1)
+		{
+			fprintf(stderr, "EventFd: error on eventfd");
+			exit(1);
+		}
+	}
+	int fd = engineJob->eventFd;
+	if (pthread_mutex_unlock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "EventFd: error on pthread_mutex_unlock");
+		exit(1);
+	}
+	return fd;
+}
+
+void getJobState(JobHandle job, JobState *state)
+{
+	auto *engineJob = (EngineJob *) job;
+	if (pthread_mutex_lock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "State: error on pthread_mutex_lock");
+		exit(1);
+	}
+	bool done = engineJob->done;
+	if (pthread_mutex_unlock(&engineJob->doneMutex) != 0)
+	{
+		fprintf(stderr, "State: error on pthread_mutex_unlock");
+		exit(1);
+	}
+	if (done)
+	{
+		state->stage = REDUCE_STAGE;
+		state->percentage = 100;
+	}
+	else
+	{
+		engineJob->task->getState(state);
+	}
+}
+
+void closeJobHandle(JobHandle job)
+{
+	waitForJob(job);
+	delete (EngineJob *) job;
+}
@@ -0,0 +1,53 @@
+#ifndef JOBENGINE_H
+#define JOBENGINE_H
+
+#include <vector>
+#include "MapReduceFramework.h"
+
+// Threading engine under every job. A parallel task runs in stages: each stage runs once for every
+// thread of the job, and all threads finish a stage before any starts the next. Threads of a job are
+// parts of its stages, run by a process-wide pool of one worker per core that all jobs share, so
+// starting a job creates no threads. Part 0 of a stage starts no later than the others, which may
+// wait for what it produces. Workers go to the jobs running fewer threads than their weighted share
+// of the cores first, then to the jobs that ran the least, weighted. They are reassigned whenever
+// they finish a part, or leave a part at its next claim of input when another job should run.
+static const int JOB_DONE = -1;
+
+class ParallelTask {
+public:
+	virtual ~ParallelTask() {}
+	// runs the stage on one of the job's threads. the first stage is 0.
+	virtual void runStage(int stage, int threadNum) = 0;
+	// runs once, after all threads finished the stage. returns the next stage, or JOB_DONE.
+	virtual int finishStage(int stage) = 0;
+	// progress while the job runs.
+	virtual void getState(JobState* state) = 0;
+};
+
+// Runs the task as multiThreadLevel threads. The job owns the task and deletes it in closeJobHandle.
+JobHandle startParallelJob(ParallelTask* task, int multiThreadLevel);
+// Same, with the job's weight, see JobOptions::weight.
+JobHandle startParallelJob(ParallelTask* task, int multiThreadLevel, unsigned int weight);
+
+class RangeDeque;
+
+// Items [0, size) of a stage, shared by its threadCount threads. Each thread starts with an even slice
+// in a deque of its own, takes ranges from its bottom, and once it runs out steals from the top of
+// random other threads' deques. Ranges larger than a grain are split in halves when taken, the upper
+// halves left for thieves, so a few expensive items don't hold up the stage. Create it before the stage.
+class WorkRanges {
+public:
+	WorkRanges(unsigned long size, int threadCount);
+	~WorkRanges();
+	// Claims the next range [start, end) for thread threadNum. Returns false once all are claimed, or
+	// when the thread's worker goes to another job: threads of the stage not started yet claim the rest.
+	bool claim(int threadNum, unsigned long* start, unsigned long* end);
+
+private:
+	bool steal(int threadNum, unsigned long* start, unsigned long* end);
+
+	std::vector<RangeDeque*> deques;
+	unsigned long grain;
+};
+
+#endif //JOBENGINE_H
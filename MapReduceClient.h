@@ -4,6 +4,9 @@
 
 #include <vector>  //std::vector
 #include <utility> //std::pair
+#include <cstdio>  //std::FILE
+#include <cstdint> //std::uint64_t
+#include <cstddef> //std::size_t
 
 // input key and value.
 // the key, value for the map function and the MapReduceFramework
@@ -24,6 +27,38 @@ class K2 {
 public:
 	virtual ~K2(){}
 	virtual bool operator<(const K2 &other) const = 0;
+	// optional: a hash of the key, equal keys must get equal hashes. together with
+	// equals, lets the framework group keys with a hash table instead of sorting
+	// them, in jobs that don't need groups in key order. returns false if not
+	// implemented.
+	virtual bool hash(std::size_t& result) const {
+		return false;
+	}
+	// optional: sets result to whether the key equals other. returns false if not
+	// implemented.
+	virtual bool equals(const K2 &other, bool& result) const {
+		return false;
+	}
+	// optional: a fixed width prefix of the key, ordered like the keys: if a < b then
+	// a's prefix <= b's prefix. sorting and merging compare prefixes first and only call
+	// operator< when they are equal. returns false if the key has no prefix.
+	virtual bool normalizedPrefix(std::uint64_t& prefix) const {
+		return false;
+	}
+	// optional: the key as an unsigned integer, for integer keys. a < b exactly
+	// when a's integer < b's integer, so equal integers mean equal keys. runs of
+	// such keys are radix sorted over the bytes their largest key needs, and
+	// grouped without operator<. returns false if the key is not an integer.
+	virtual bool integerKey(std::uint64_t& key) const {
+		return false;
+	}
+	// optional: the bytes of the key, for keys ordered like their bytes: compared
+	// as unsigned chars, a proper prefix first, like std::string. runs of such keys
+	// are MSD radix sorted by their bytes and compared without operator<. the bytes
+	// must stay valid while the key lives. returns false if the key has no bytes.
+	virtual bool keyBytes(const char*& bytes, std::size_t& size) const {
+		return false;
+	}
 };
 
 class V2 {
@@ -65,6 +100,130 @@ public:
 	// to output (K3, V3) pairs.
 	virtual void reduce(const IntermediateVec* pairs, void* context)
 		const = 0;
+
+	// same as reduce, for the pairs in [begin, end) of a buffer owned by the
+	// framework. override it to read the pairs in place, by default they are
+	// copied into a vector for reduce.
+	virtual void reduceRange(const IntermediatePair* begin,
+		const IntermediatePair* end, void* context) const {
+		const IntermediateVec pairs(begin, end);
+		reduce(&pairs, context);
+	}
+
+	// optional map-side combiner. gets the pairs of a single K2 key emitted by one
+	// thread and calls emit2(K2, V2, context) any number of times (usually once)
+	// to replace them, using the same key. owns the given pairs, like reduce.
+	// returns false if the client has no combiner.
+	virtual bool combine(const IntermediateVec* pairs, void* context) const {
+		return false;
+	}
+
+	// optional serialization of intermediate pairs, used to spill them to disk
+	// when a job goes over its memory budget. writes the pair to the file and
+	// releases it. returns false if the client can't spill.
+	virtual bool spill(const IntermediatePair& pair, std::FILE* file) const {
+		return false;
+	}
+
+	// reads back a pair written by spill, as newly allocated objects.
+	virtual IntermediatePair unspill(std::FILE* file) const {
+		return IntermediatePair(nullptr, nullptr);
+	}
+
+	// approximate bytes of memory a pair takes, including its key and value.
+	// counted against the job's memory budget.
+	virtual unsigned long pairSize(const IntermediatePair& pair) const {
+		return sizeof(IntermediatePair);
+	}
+
+	// optional: hashes a K2 key to pick its partition in HASH_SHUFFLE jobs, for
+	// keys that don't implement K2::hash. equal keys must get equal hashes.
+	// returns false if not implemented.
+	virtual bool partitionHash(const K2* key, unsigned long& result) const {
+		return false;
+	}
+
+	// optional: whether map only emits pairs with nullptr values, so a group
+	// only matters by its key and size. pairs whose keys implement K2::hash and
+	// K2::equals are then counted as they are emitted, keeping one key and a
+	// count per distinct key, and their groups go to reduceCount instead of
+	// reduce. jobs whose keys don't, checked on the first key emitted, and
+	// sorted output jobs still call reduce.
+	virtual bool countOnly() const {
+		return false;
+	}
+
+	// reduces a key emitted count times by a countOnly client, calling
+	// emit3(K3, V3, context) like reduce. owns the key.
+	virtual void reduceCount(K2* key, unsigned long count, void* context) const {
+	}
+
+	// releases an emitted key once an equal key stands for it, when pairs are
+	// folded as they are emitted. keys allocated with jobNew must override it
+	// to do nothing.
+	virtual void releaseKey(K2* key) const {
+		delete key;
+	}
+};
+
+// a client whose reduce folds the values of a key one at a time, like sums,
+// counts or minimums. for keys implementing K2::hash and K2::equals, the
+// framework folds pairs into per thread hash tables as they are emitted,
+// merges the tables of all threads, and finalizes each key once: no pairs are
+// kept, sorted or shuffled. keys without them, and jobs with sorted output, go
+// through reduce, which folds a group the same way. partial results are opaque
+// to the framework.
+class AggregateClient : public MapReduceClient {
+public:
+	// creates the partial result of a key, before its first value.
+	virtual void* init(const K2* key) const = 0;
+
+	// folds a value of the key into its partial result. owns the value, the
+	// key is only valid during the call.
+	virtual void accumulate(void* partial, const K2* key, V2* value) const = 0;
+
+	// folds the partial result other, of the same key, into partial and
+	// releases other.
+	virtual void merge(void* partial, void* other) const = 0;
+
+	// calls emit3(K3, V3, context) for the key's result, usually once. owns
+	// the key and the partial result.
+	virtual void finalize(K2* key, void* partial, void* context) const = 0;
+
+	// folds the group, keeping its first key.
+	virtual void reduce(const IntermediateVec* pairs, void* context) const {
+		K2* key = pairs->front().first;
+		void* partial = init(key);
+		for (const IntermediatePair& pair : *pairs) {
+			accumulate(partial, pair.first, pair.second);
+			if (pair.first != key) {
+				releaseKey(pair.first);
+			}
+		}
+		finalize(key, partial, context);
+	}
+};
+
+// a client whose intermediate keys are the integers [0, domainSize()), with
+// values summed per key, like counts or sums. map calls emitDense(key, value,
+// context) instead of emit2: each thread adds into flat arrays indexed by key,
+// the arrays of all threads are summed elementwise, and reduceDense gets every
+// key emitted at least once, in key order. nothing is sorted or shuffled, so
+// domains should be small, each thread keeps 16 bytes per key.
+class DenseClient : public MapReduceClient {
+public:
+	// number of keys, emitDense takes keys below it.
+	virtual unsigned long domainSize() const = 0;
+
+	// calls emit3(K3, V3, context) for a key emitted count times, whose values
+	// add up to sum.
+	virtual void reduceDense(unsigned long key, std::uint64_t count,
+		std::uint64_t sum, void* context) const = 0;
+
+	// pairs emitted with emit2 still go to reduce, clients that emit them
+	// override it.
+	virtual void reduce(const IntermediateVec* pairs, void* context) const {
+	}
 };
 
 #endif
\ No newline at end of file
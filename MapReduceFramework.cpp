@@ -1,11 +1,14 @@
-#include <pthread.h>
 #include <atomic>
 #include <iostream>
 #include <utility>
 #include <algorithm>
-#include <semaphore.h>
+#include <cstring>
+#include <cstdint>
 #include "MapReduceFramework.h"
-#include "Barrier.h"
+#include "JobEngine.h"
+#include "GroupQueue.h"
+#include "Arena.h"
+#include "AggregateTable.h"
 
 using std::cout;
 using std::endl;
@@ -15,284 +18,1936 @@ using std::pair;
 struct JobContext;
 struct ThreadContext;
 
+// Number of hash partitions owned by each thread in HASH_SHUFFLE jobs.
+static const unsigned long PARTITIONS_PER_THREAD = 4;
+// Most spilled runs merged at once, larger spills take several merge passes.
+static const unsigned long MERGE_FAN_IN = 16;
+// Groups the final merge of a spilled job may queue up per reducing thread.
+static const unsigned long QUEUED_GROUPS_PER_THREAD = 2;
+// Groups the in-memory shuffle may queue up per thread. Groups are views, so they take little memory.
+static const unsigned long PIPELINED_GROUPS_PER_THREAD = 64;
+// Pairs the in-memory shuffle merges between handing out the groups found so far.
+static const unsigned long SHUFFLE_BATCH_SIZE = 4096;
+// Size of a cache line, in bytes.
+static const int CACHE_LINE_SIZE = 64;
+// Bits of an integer key sorted by each radix sort pass.
+static const int RADIX_BITS = 8;
+// Number of buckets in a radix sort pass.
+static const unsigned long RADIX_SIZE = 1UL << RADIX_BITS;
+// Buckets of byte keys smaller than this are sorted by comparing the keys, not radix sorted further.
+static const unsigned long MSD_CUTOFF = 32;
+// Slots per key in the hash tables that group keys, at least. A power of two.
+static const unsigned long HASH_SLOTS_PER_KEY = 2;
+
 // Comparator.
 bool comparePtrToPair(IntermediatePair a, IntermediatePair b)
 { return a.first->operator<(*b.first); }
 
+// Comparator for bare keys.
+bool compareKeys(const K2 *a, const K2 *b)
+{ return a->operator<(*b); }
+
+/**
+ * @brief How the prefixes kept next to a sorted run relate to its keys.
+ */
+enum prefix_t
+{
+	// The keys have no prefixes.
+	NO_PREFIX,
+	// Normalized prefixes, keys with equal prefixes are still compared with operator<.
+	NORMALIZED_PREFIX,
+	// Integer keys, equal prefixes mean equal keys.
+	INTEGER_PREFIX,
+	// The first bytes of byte keys, keys with equal prefixes are compared by their bytes.
+	BYTES_PREFIX
+};
+
+/**
+ * @brief Intermediate pair with its key's prefix stored inline, for sorting.
+ */
+typedef struct PrefixedPair
+{
+	uint64_t prefix;
+	IntermediatePair pair;
+} PrefixedPair;
+
+// Compares prefixes, and the keys themselves only when the prefixes are equal.
+bool comparePrefixed(const PrefixedPair &a, const PrefixedPair &b)
+{ return a.prefix != b.prefix ? a.prefix < b.prefix : a.pair.first->operator<(*b.pair.first); }
+
+/**
+ * @brief Compares the bytes of two keys from depth on, the first depth bytes being equal.
+ * Returns a negative number, 0 or a positive number, like memcmp. A proper prefix comes first.
+ */
+int compareBytesFrom(const char *a, std::size_t aSize, const char *b, std::size_t bSize, std::size_t depth)
+{
+	int res = memcmp(a + depth, b + depth, std::min(aSize, bSize) - depth);
+	if (res != 0)
+	{
+		return res;
+	}
+	return aSize < bSize ? -1 : (aSize > bSize ? 1 : 0);
+}
+
+// Compares two byte keys.
+int compareBytes(const K2 *a, const K2 *b)
+{
+	const char *aBytes, *bBytes;
+	std::size_t aSize, bSize;
+	a->keyBytes(aBytes, aSize);
+	b->keyBytes(bBytes, bSize);
+	return compareBytesFrom(aBytes, aSize, bBytes, bSize, 0);
+}
+
+// Compares two keys whose prefixes are of the given kind and equal.
+bool lessKeys(const K2 *a, const K2 *b, prefix_t kind)
+{
+	if (kind == BYTES_PREFIX)
+	{
+		return compareBytes(a, b) < 0;
+	}
+	return kind != INTEGER_PREFIX && a->operator<(*b);
+}
+
+// First 8 bytes of a key, big endian and zero padded, so prefixes are ordered like the bytes.
+uint64_t bytesPrefix(const char *bytes, std::size_t size)
+{
+	uint64_t prefix = 0;
+	for (std::size_t i = 0; i < sizeof(prefix); ++i)
+	{
+		prefix = (prefix << 8) | (i < size ? (unsigned char) bytes[i] : 0);
+	}
+	return prefix;
+}
+
+/**
+ * @brief Finds which kind of prefix a key has, and reads it.
+ */
+prefix_t firstPrefix(const K2 *key, uint64_t &prefix)
+{
+	const char *bytes;
+	std::size_t size;
+	if (key->integerKey(prefix))
+	{
+		return INTEGER_PREFIX;
+	}
+	if (key->keyBytes(bytes, size))
+	{
+		prefix = bytesPrefix(bytes, size);
+		return BYTES_PREFIX;
+	}
+	return key->normalizedPrefix(prefix) ? NORMALIZED_PREFIX : NO_PREFIX;
+}
+
+// Reads a key's prefix of the given kind.
+void readPrefix(const K2 *key, prefix_t kind, uint64_t &prefix)
+{
+	const char *bytes;
+	std::size_t size;
+	if (kind == INTEGER_PREFIX)
+	{
+		key->integerKey(prefix);
+	}
+	else if (kind == BYTES_PREFIX)
+	{
+		key->keyBytes(bytes, size);
+		prefix = bytesPrefix(bytes, size);
+	}
+	else
+	{
+		key->normalizedPrefix(prefix);
+	}
+}
+
+/**
+ * @brief LSD radix sort of integer keys, a pass per byte up to the largest key's width.
+ * Passes where all keys share the byte are skipped.
+ */
+void radixSort(vector<PrefixedPair> *entries)
+{
+	uint64_t keyBits = 0;
+	for (const PrefixedPair &entry:*entries)
+	{
+		keyBits |= entry.prefix;
+	}
+	vector<PrefixedPair> buffer(entries->size());
+	for (int shift = 0; shift < 64 && (keyBits >> shift) != 0; shift += RADIX_BITS)
+	{
+		vector<unsigned long> offsets(RADIX_SIZE + 1, 0);
+		for (const PrefixedPair &entry:*entries)
+		{
+			offsets[((entry.prefix >> shift) & (RADIX_SIZE - 1)) + 1]++;
+		}
+		if (std::find(offsets.begin(), offsets.end(), entries->size()) != offsets.end())
+		{
+			continue;
+		}
+		for (unsigned long digit = 1; digit <= RADIX_SIZE; ++digit)
+		{
+			offsets[digit] += offsets[digit - 1];
+		}
+		for (const PrefixedPair &entry:*entries)
+		{
+			buffer[offsets[(entry.prefix >> shift) & (RADIX_SIZE - 1)]++] = entry;
+		}
+		entries->swap(buffer);
+	}
+}
+
+/**
+ * @brief Intermediate pair with its key's bytes stored inline, for sorting.
+ */
+typedef struct BytesPair
+{
+	const char *bytes;
+	std::size_t size;
+	IntermediatePair pair;
+} BytesPair;
+
+// Radix bucket of a byte key at depth: 0 if the key ends before it, the byte + 1 otherwise.
+unsigned long bucketAt(const BytesPair &entry, std::size_t depth)
+{ return depth < entry.size ? (unsigned char) entry.bytes[depth] + 1UL : 0; }
+
+/**
+ * @brief MSD radix sort of byte keys sharing their first depth bytes, a byte at a time.
+ * Small buckets are sorted by comparing the bytes left. buffer has room for size entries.
+ */
+void msdSort(BytesPair *entries, BytesPair *buffer, unsigned long size, std::size_t depth)
+{
+	while (size >= MSD_CUTOFF)
+	{
+		vector<unsigned long> offsets(RADIX_SIZE + 2, 0);
+		for (unsigned long i = 0; i < size; ++i)
+		{
+			offsets[bucketAt(entries[i], depth) + 1]++;
+		}
+		if (offsets[1] == size)
+		{
+			// All keys end here, so they are equal.
+			return;
+		}
+		if (std::find(offsets.begin() + 2, offsets.end(), size) != offsets.end())
+		{
+			// All keys share this byte.
+			depth++;
+			continue;
+		}
+		for (unsigned long bucket = 1; bucket < offsets.size(); ++bucket)
+		{
+			offsets[bucket] += offsets[bucket - 1];
+		}
+		vector<unsigned long> starts(offsets);
+		for (unsigned long i = 0; i < size; ++i)
+		{
+			buffer[offsets[bucketAt(entries[i], depth)]++] = entries[i];
+		}
+		std::copy(buffer, buffer + size, entries);
+		for (unsigned long bucket = 1; bucket <= RADIX_SIZE; ++bucket)
+		{
+			msdSort(entries + starts[bucket], buffer + starts[bucket], starts[bucket + 1] - starts[bucket],
+					depth + 1);
+		}
+		return;
+	}
+	std::sort(entries, entries + size, [depth](const BytesPair &a, const BytesPair &b)
+	{
+		return compareBytesFrom(a.bytes, a.size, b.bytes, b.size, depth) < 0;
+	});
+}
+
+/**
+ * @brief Sorts a run of byte keys with an MSD radix sort, and reads their prefixes.
+ */
+void sortBytesRun(IntermediateVec *run, vector<uint64_t> *prefixes)
+{
+	vector<BytesPair> entries(run->size());
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		run->at(i).first->keyBytes(entries[i].bytes, entries[i].size);
+		entries[i].pair = run->at(i);
+	}
+	vector<BytesPair> buffer(run->size());
+	msdSort(entries.data(), buffer.data(), entries.size(), 0);
+	if (prefixes != nullptr)
+	{
+		prefixes->resize(run->size());
+	}
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		run->at(i) = entries[i].pair;
+		if (prefixes != nullptr)
+		{
+			prefixes->at(i) = bytesPrefix(entries[i].bytes, entries[i].size);
+		}
+	}
+}
+
+/**
+ * @brief Sorts a run of pairs by key. Integer and byte keys are radix sorted, keys with normalized
+ * prefixes are sorted by prefix first. The prefixes of the sorted run are kept in prefixes, if given.
+ * Returns the kind of prefix the keys have.
+ */
+prefix_t sortRun(IntermediateVec *run, vector<uint64_t> *prefixes)
+{
+	uint64_t prefix;
+	if (prefixes != nullptr)
+	{
+		prefixes->clear();
+	}
+	prefix_t kind = run->empty() ? NO_PREFIX : firstPrefix(run->front().first, prefix);
+	if (kind == NO_PREFIX)
+	{
+		std::sort(run->begin(), run->end(), comparePtrToPair);
+		return kind;
+	}
+	if (kind == BYTES_PREFIX)
+	{
+		sortBytesRun(run, prefixes);
+		return kind;
+	}
+	vector<PrefixedPair> prefixed(run->size());
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		readPrefix(run->at(i).first, kind, prefixed[i].prefix);
+		prefixed[i].pair = run->at(i);
+	}
+	if (kind == INTEGER_PREFIX)
+	{
+		radixSort(&prefixed);
+	}
+	else
+	{
+		std::sort(prefixed.begin(), prefixed.end(), comparePrefixed);
+	}
+	if (prefixes != nullptr)
+	{
+		prefixes->resize(run->size());
+	}
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		run->at(i) = prefixed[i].pair;
+		if (prefixes != nullptr)
+		{
+			prefixes->at(i) = prefixed[i].prefix;
+		}
+	}
+	return kind;
+}
+
+/**
+ * @brief Refills the prefixes of a sorted run, after its pairs changed. Returns their kind.
+ */
+prefix_t fillPrefixes(const IntermediateVec *run, vector<uint64_t> *prefixes)
+{
+	uint64_t prefix;
+	prefixes->clear();
+	prefix_t kind = run->empty() ? NO_PREFIX : firstPrefix(run->front().first, prefix);
+	if (kind == NO_PREFIX)
+	{
+		return kind;
+	}
+	prefixes->resize(run->size());
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		readPrefix(run->at(i).first, kind, prefixes->at(i));
+	}
+	return kind;
+}
+
+/**
+ * @brief Slot of the hash table grouping keys.
+ */
+typedef struct HashSlot
+{
+	// Hash of the group's key.
+	std::size_t hash;
+	// Index of the group, -1 for an empty slot.
+	long group;
+} HashSlot;
+
+/**
+ * @brief Groups a run of pairs with an open addressing hash table, when its keys implement hash and
+ * equals. Reorders the run so equal keys are contiguous, groups in order of first appearance, and
+ * sets groups to each pair's group index, ascending. Returns false, leaving the run as is, if the
+ * keys don't implement both.
+ */
+bool hashGroupRun(IntermediateVec *run, vector<uint64_t> *groups)
+{
+	std::size_t hash;
+	bool equal;
+	groups->clear();
+	if (run->empty() || !run->front().first->hash(hash) || !run->front().first->equals(*run->front().first, equal))
+	{
+		return false;
+	}
+	int tableBits = 1;
+	while ((1UL << tableBits) < HASH_SLOTS_PER_KEY * run->size())
+	{
+		tableBits++;
+	}
+	vector<HashSlot> table(1UL << tableBits, HashSlot{0, -1});
+	vector<K2 *> groupKeys;
+	vector<unsigned long> offsets(1, 0);
+	groups->resize(run->size());
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		K2 *key = run->at(i).first;
+		key->hash(hash);
+		auto slot = (unsigned long) hashSlot(hash, tableBits);
+		while (table[slot].group != -1)
+		{
+			if (table[slot].hash == hash)
+			{
+				key->equals(*groupKeys[table[slot].group], equal);
+				if (equal)
+				{
+					break;
+				}
+			}
+			slot = (slot + 1) & (table.size() - 1);
+		}
+		if (table[slot].group == -1)
+		{
+			table[slot].hash = hash;
+			table[slot].group = (long) groupKeys.size();
+			groupKeys.push_back(key);
+			offsets.push_back(0);
+		}
+		groups->at(i) = (uint64_t) table[slot].group;
+		offsets[table[slot].group + 1]++;
+	}
+
+	// Counting sort by group.
+	for (unsigned long group = 1; group < offsets.size(); ++group)
+	{
+		offsets[group] += offsets[group - 1];
+	}
+	IntermediateVec grouped(run->size());
+	for (unsigned long i = 0; i < run->size(); ++i)
+	{
+		grouped[offsets[groups->at(i)]++] = run->at(i);
+	}
+	run->swap(grouped);
+	unsigned long i = 0;
+	for (unsigned long group = 0; group < groupKeys.size(); ++group)
+	{
+		for (; i < offsets[group]; ++i)
+		{
+			groups->at(i) = group;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Brings the equal keys of a run together: with a hash table if its keys implement hash and
+ * equals, in no particular order, by sorting it otherwise. Keeps what groups them in prefixes, and
+ * returns its kind. Hash tables give group indices, which group like integer keys.
+ */
+prefix_t groupRun(IntermediateVec *run, vector<uint64_t> *prefixes)
+{
+	return hashGroupRun(run, prefixes) ? INTEGER_PREFIX : sortRun(run, prefixes);
+}
+
+/**
+ * @brief End of the group of equal keys starting at begin, in a sorted range. prefixes are the
+ * prefixes of the range from begin on, of the given kind. Gallops from begin, so a group of n keys
+ * takes about 2 log n key checks. Integer and byte keys are checked without operator<.
+ */
+IntermediateVec::iterator groupEnd(IntermediateVec::iterator begin, IntermediateVec::iterator end,
+								   const uint64_t *prefixes, prefix_t kind)
+{
+	auto sameGroup = [&](long i) -> bool
+	{
+		if (kind != NO_PREFIX && prefixes[i] != prefixes[0])
+		{
+			return false;
+		}
+		if (kind == INTEGER_PREFIX)
+		{
+			return true;
+		}
+		if (kind == BYTES_PREFIX)
+		{
+			return compareBytes(begin->first, begin[i].first) == 0;
+		}
+		// Keys after begin in a sorted range are equal to it unless greater.
+		return !begin->first->operator<(*begin[i].first);
+	};
+	long size = end - begin;
+	long equal = 0;
+	long probe = 1;
+	while (probe < size && sameGroup(probe))
+	{
+		equal = probe;
+		probe *= 2;
+	}
+	// The group ends in (equal, probe].
+	long differs = std::min(probe, size);
+	while (differs - equal > 1)
+	{
+		long mid = equal + (differs - equal) / 2;
+		if (sameGroup(mid))
+		{
+			equal = mid;
+		}
+		else
+		{
+			differs = mid;
+		}
+	}
+	return begin + differs;
+}
+
+/**
+ * @brief Calls handleGroup(groupBegin, groupEnd) on every run of equal keys in a sorted range.
+ * prefixes are the prefixes of the range, of the given kind.
+ */
+template<class Handler>
+void forEachGroup(IntermediateVec::iterator begin, IntermediateVec::iterator end, const uint64_t *prefixes,
+				  prefix_t kind, Handler handleGroup)
+{
+	while (begin != end)
+	{
+		auto next = groupEnd(begin, end, prefixes, kind);
+		handleGroup(begin, next);
+		if (kind != NO_PREFIX)
+		{
+			prefixes += next - begin;
+		}
+		begin = next;
+	}
+}
+
+/**
+ * @brief Output pairs emitted by one thread, padded so neighbouring buffers never share a cache line.
+ */
+typedef struct OutputBuffer
+{
+	// Keeps this buffer off the cache line of the previous one.
+	char padding[CACHE_LINE_SIZE];
+	// Pairs emitted by the owning thread.
+	OutputVec pairs;
+} OutputBuffer;
+
+/**
+ * @brief Sorted run of intermediate pairs spilled to a temporary file.
+ */
+typedef struct SpillRun
+{
+	std::FILE *file;
+	// Number of pairs in the run.
+	unsigned long size;
+} SpillRun;
+
+/**
+ * @brief Aggregates the valueless pairs of a countOnly client: the partial result of a key is its count,
+ * kept in the partial pointer itself so counting allocates nothing. accumulate and merge get the pointer by
+ * value, so the framework adds counts in place with add instead.
+ */
+class CountAggregator final : public AggregateClient
+{
+public:
+	explicit CountAggregator(const MapReduceClient &_client) : client(_client)
+	{}
+
+	void map(const K1 *key, const V1 *value, void *context) const override
+	{ client.map(key, value, context); }
+
+	void reduce(const IntermediateVec *pairs, void *context) const override
+	{ client.reduce(pairs, context); }
+
+	void releaseKey(K2 *key) const override
+	{ client.releaseKey(key); }
+
+	void *init(const K2 *key) const override
+	{ return nullptr; }
+
+	void accumulate(void *partial, const K2 *key, V2 *value) const override
+	{ unreachable("accumulate"); }
+
+	void merge(void *partial, void *other) const override
+	{ unreachable("merge"); }
+
+	void finalize(K2 *key, void *partial, void *context) const override
+	{ client.reduceCount(key, (unsigned long) (uintptr_t) partial, context); }
+
+	/**
+	 * @brief Adds count to the count kept in partial.
+	 */
+	static void add(void *&partial, uintptr_t count)
+	{ partial = (void *) ((uintptr_t) partial + count); }
+
+private:
+	static void unreachable(const char *call)
+	{
+		fprintf(stderr, "CountAggregator: error on %s, counts are added with add\n", call);
+		exit(1);
+	}
+
+	const MapReduceClient &client;
+};
+
+/**
+ * @brief Context of a thread.
+ */
+typedef struct ThreadContext
+{
+	// Job that spawned the thread.
+	JobContext *jobContext;
+	// Number of thread given upon initialization.
+	int threadNum;
+	// Input vector given by client. Shared read-only by all threads, never copied.
+	const InputVec *inputVec;
+	// Intermediate vector.
+	vector<IntermediatePair> *interVec;
+	// Prefixes of the keys in interVec once sorted, empty if the keys have none.
+	vector<uint64_t> *prefixes;
+	// How the prefixes relate to the keys.
+	prefix_t prefixKind;
+	// Intermediate pairs scattered by key hash, used instead of interVec in hash grouped jobs.
+	vector<IntermediateVec> *partitions;
+	// Keys sampled from interVec once sorted, to pick the splitters by.
+	vector<K2 *> *samples;
+	// Where this thread's key range starts and ends in every thread's sorted run.
+	vector<pair<unsigned long, unsigned long> > *slices;
+	// This thread's key range merged out of all sorted runs. Groups are views into it.
+	IntermediateVec *merged;
+	// Bytes of intermediate pairs held in interVec, counted against the memory budget.
+	unsigned long interBytes;
+	// Sorted runs this thread spilled to disk.
+	vector<SpillRun> *spillRuns;
+	// Whether interVec is spilled once it goes over the memory budget.
+	bool canSpill;
+	// Whether a run is being spilled or combined right now, so emits of its combiner don't spill again.
+	bool spilling;
+	// Partial results of an aggregating client, table i holding the keys thread i finalizes.
+	vector<AggregateTable> *tables;
+	// How often a DenseClient emitted each key from this thread, and the sum of the values, by key.
+	vector<uint64_t> *denseCounts;
+	vector<uint64_t> *denseSums;
+	// Input ranges of the job, this thread takes its own first and then steals.
+	WorkRanges *inputRanges;
+	// Output vector.
+	OutputVec *outputVec;
+	// Output pairs emitted by this thread, spliced into the output vector when the job ends.
+	OutputVec *outputBuffer;
+	// Memory the client allocates from this thread with jobAlloc, freed in closeJobHandle.
+	Arena *arena;
+	// Client.
+	const MapReduceClient *client;
+
+	// Ctor.
+	ThreadContext(JobContext *_jobContext, int _threadNum, const InputVec &_inputVec,
+				  WorkRanges *_inputRanges, OutputVec &_outputVec, OutputVec *_outputBuffer,
+				  const MapReduceClient *_client) :
+			jobContext(_jobContext), threadNum(_threadNum), inputVec(&_inputVec),
+			interVec(new IntermediateVec()), prefixes(new vector<uint64_t>()),
+			prefixKind(NO_PREFIX), partitions(new vector<IntermediateVec>()), samples(new vector<K2 *>()),
+			slices(new vector<pair<unsigned long, unsigned long> >()), merged(new IntermediateVec()), interBytes(0), spillRuns(new vector<SpillRun>()), canSpill(false), spilling(false),
+			tables(new vector<AggregateTable>()), denseCounts(new vector<uint64_t>()),
+			denseSums(new vector<uint64_t>()),
+			inputRanges(_inputRanges),
+			outputVec(&_outputVec), outputBuffer(_outputBuffer), arena(new Arena()), client(_client)
+	{}
+
+} ThreadContext;
+
+/**
+ * @brief Where a job's pairs go once emitted, decided on the first key the job emits.
+ */
+enum grouping_t
+{
+	// No key emitted yet.
+	UNDECIDED_GROUPING,
+	// Hash partitions, grouped by the threads owning them.
+	HASH_GROUPING,
+	// Each thread's interVec, sorted and merged.
+	SORT_GROUPING
+};
+
+/**
+ * @brief Whether an aggregating job folds its pairs as they are emitted, decided on the first key the job
+ * emits.
+ */
+enum aggregation_t
+{
+	// No key emitted yet.
+	UNDECIDED_AGGREGATION,
+	// Keys implement K2::hash and K2::equals, pairs are folded into hash tables.
+	HASH_AGGREGATION,
+	// Pairs are emitted like those of any other client, and go through reduce.
+	NO_AGGREGATION
+};
+
+/**
+ * @brief Phases of a MapReduce job, run as stages of a parallel task.
+ */
+enum phase_t
+{
+	MAP_PHASE, DENSE_PHASE, AGGREGATE_PHASE, SLICE_PHASE, SHUFFLE_PHASE, PARTITIONS_PHASE, MERGE_PASS_PHASE,
+	STREAM_PHASE, SPLICE_PHASE
+};
+
+/**
+ * @brief Context of a job.
+ */
+typedef struct JobContext : public ParallelTask
+{
+	// Context of each thread of this job.
+	vector<ThreadContext *> *threads{};
+	// Settings given by the client.
+	JobOptions options;
+	// Output vector given by client.
+	OutputVec *outputVec;
+	// Client, if it is an AggregateClient and pairs with hashable keys are folded as they are emitted.
+	// For countOnly clients, counts their valueless pairs instead.
+	const AggregateClient *aggregator;
+	// Aggregator counting the pairs of a countOnly client, owned by the job.
+	CountAggregator *counter;
+	// Client, if it is a DenseClient.
+	const DenseClient *dense;
+	// Number of keys of the DenseClient.
+	unsigned long denseDomain;
+	// Inputs left to map, split between the threads.
+	WorkRanges *inputRanges;
+	// Where the job's pairs go, the same for all threads.
+	std::atomic<grouping_t> grouping;
+	// Whether the pairs of an aggregating client are folded as emitted, the same for all threads.
+	std::atomic<aggregation_t> aggregation;
+	// Stage of the job, set by its threads and read by getJobState.
+	std::atomic<stage_t> currentStage;
+	// Progress of the current stage, in percent, updated by every thread as it goes.
+	std::atomic<float> percentage;
+	// Keys splitting the intermediate key space between the threads, picked before shuffling.
+	vector<K2 *> *splitters;
+	// Number of intermediate pairs once mapping is done.
+	unsigned long pairCount;
+	// Number of intermediate pairs reduced so far.
+	std::atomic<unsigned long> reducedCount;
+	// Number of inputs mapped so far.
+	std::atomic<unsigned long> mappedCount;
+	// Share of the memory budget of each thread, in bytes.
+	unsigned long threadBudget;
+	// Whether any thread spilled, so the shuffle merges from disk.
+	bool spilled;
+	// Spilled runs left to merge.
+	vector<SpillRun> *mergeRuns;
+	// Runs written by the current merge pass.
+	vector<SpillRun> *nextRuns;
+	// Index of the next batch of runs to merge in the current pass.
+	std::atomic<unsigned long> mergeCounter;
+	// Groups streamed by the final merge of a spilled job, or by the in-memory shuffle, consumed by all threads.
+	GroupQueue *groupQueue;
+	// Output buffer of every thread.
+	OutputBuffer *outputBuffers;
+	// Index in the output vector where each thread's buffer is spliced.
+	vector<unsigned long> *outputOffsets;
+
+	// Ctor for a JobContext instance. Receives _threads as pointer.
+	JobContext(vector<ThreadContext *> *_threads, int threadCount, const JobOptions &_options,
+			   unsigned long inputSize, OutputVec &_outputVec, const AggregateClient *_aggregator) :
+			threads(_threads), options(_options), outputVec(&_outputVec), aggregator(_aggregator),
+			counter(nullptr), dense(nullptr), denseDomain(0), inputRanges(new WorkRanges(inputSize, threadCount)),
+			grouping(UNDECIDED_GROUPING), aggregation(UNDECIDED_AGGREGATION), splitters(new vector<K2 *>()),
+			pairCount(0), reducedCount(0), mappedCount(0),
+			threadBudget(_options.memoryBudget / threadCount), spilled(false), mergeRuns(new vector<SpillRun>()),
+			nextRuns(new vector<SpillRun>()), mergeCounter(0), groupQueue(nullptr),
+			outputBuffers(new OutputBuffer[threadCount]), outputOffsets(new vector<unsigned long>())
+	{
+		currentStage.store(UNDEFINED_STAGE);
+		percentage.store(0);
+	}
+
+	~JobContext()
+	{
+		for (ThreadContext *tc:*threads)
+		{
+			delete tc->interVec;
+			delete tc->prefixes;
+			delete tc->partitions;
+			delete tc->samples;
+			delete tc->slices;
+			delete tc->merged;
+			delete tc->arena;
+			delete tc->spillRuns;
+			delete tc->tables;
+			delete tc->denseCounts;
+			delete tc->denseSums;
+			delete tc;
+		}
+		delete threads;
+		delete splitters;
+		delete[] outputBuffers;
+		delete outputOffsets;
+		delete mergeRuns;
+		delete nextRuns;
+		delete groupQueue;
+		delete counter;
+		delete inputRanges;
+	}
+
+	void runStage(int stage, int threadNum) override;
+
+	int finishStage(int stage) override;
+
+	void getState(JobState *jobState) override
+	{
+		jobState->stage = currentStage.load();
+		jobState->percentage = percentage.load();
+	}
+} JobContext;
+
+void spillPhase(ThreadContext *context);
+
+// Whether the thread's pairs go to hash partitions rather than interVec.
+bool hashPartitioned(ThreadContext *context)
+{ return context->jobContext->grouping.load() == HASH_GROUPING; }
+
+/**
+ * @brief Where the job's pairs go, decided on the first key the job emits. Keys of HASH_SHUFFLE jobs that
+ * implement neither K2::hash nor MapReduceClient::partitionHash are sorted, rather than all sent to one
+ * partition. Keys of SORT_SHUFFLE jobs that implement K2::hash and K2::equals are grouped with hash tables
+ * instead of sorted, unless the job may spill: groups of such jobs are not reduced in key order anyway.
+ */
+grouping_t decideGrouping(ThreadContext *context, const K2 *key)
+{
+	JobContext *jobContext = context->jobContext;
+	grouping_t grouping = jobContext->grouping.load();
+	if (grouping != UNDECIDED_GROUPING)
+	{
+		return grouping;
+	}
+	std::size_t hash;
+	unsigned long clientHash;
+	bool equal;
+	grouping_t decided = SORT_GROUPING;
+	if (jobContext->options.shuffle == HASH_SHUFFLE &&
+		(key->hash(hash) || context->client->partitionHash(key, clientHash)))
+	{
+		decided = HASH_GROUPING;
+	}
+	if (jobContext->options.shuffle == SORT_SHUFFLE && jobContext->options.memoryBudget == 0 && key->hash(hash) &&
+		key->equals(*key, equal))
+	{
+		decided = HASH_GROUPING;
+	}
+	// Threads emitting their first keys at once all go with the first decision.
+	jobContext->grouping.compare_exchange_strong(grouping, decided);
+	return jobContext->grouping.load();
+}
+
+/**
+ * @brief Whether the job folds pairs as they are emitted, decided on the first key the job emits. Folding
+ * needs keys implementing both K2::hash and K2::equals, jobs whose keys don't go through reduce.
+ */
+aggregation_t decideAggregation(JobContext *jobContext, const K2 *key)
+{
+	aggregation_t aggregation = jobContext->aggregation.load();
+	if (aggregation != UNDECIDED_AGGREGATION)
+	{
+		return aggregation;
+	}
+	std::size_t hash;
+	bool equal;
+	aggregation_t decided = key->hash(hash) && key->equals(*key, equal) ? HASH_AGGREGATION : NO_AGGREGATION;
+	// Threads emitting their first keys at once all go with the first decision.
+	jobContext->aggregation.compare_exchange_strong(aggregation, decided);
+	return jobContext->aggregation.load();
+}
+
+// Hash partition of a key, by the key's own hash or else the client's partitionHash.
+unsigned long partitionOf(ThreadContext *context, const K2 *key)
+{
+	std::size_t hash;
+	unsigned long clientHash;
+	if (!key->hash(hash))
+	{
+		context->client->partitionHash(key, clientHash);
+		hash = clientHash;
+	}
+	return hash % context->partitions->size();
+}
+
+/**
+ * @brief Folds an emitted pair into the partial result of its key, in the table of the thread that
+ * finalizes the key.
+ */
+void aggregate(ThreadContext *context, K2 *key, V2 *value, std::size_t hash)
+{
+	const AggregateClient *aggregator = context->jobContext->aggregator;
+	bool inserted;
+	AggregateTable::Entry *entry = context->tables->at(hash % context->tables->size()).find(key, hash, &inserted);
+	if (inserted)
+	{
+		entry->partial = aggregator->init(key);
+	}
+	if (context->jobContext->counter != nullptr)
+	{
+		CountAggregator::add(entry->partial, 1);
+	}
+	else
+	{
+		aggregator->accumulate(entry->partial, key, value);
+	}
+	if (!inserted)
+	{
+		aggregator->releaseKey(key);
+	}
+}
+
+/**
+ * @brief Emits pairs into the intermediate vector of the thread, or its hash partition. Pairs of an
+ * aggregating client are folded right away.
+ */
+void emit2(K2 *key, V2 *value, void *context)
+{
+	auto curr_context = (ThreadContext *) context;
+	JobContext *jobContext = curr_context->jobContext;
+	std::size_t hash;
+	if (jobContext->aggregator != nullptr && (value == nullptr || jobContext->counter == nullptr) &&
+		decideAggregation(jobContext, key) == HASH_AGGREGATION)
+	{
+		key->hash(hash);
+		aggregate(curr_context, key, value, hash);
+		return;
+	}
+	auto p = IntermediatePair(key, value);
+	if (decideGrouping(curr_context, key) == HASH_GROUPING)
+	{
+		vector<IntermediateVec> *partitions = curr_context->partitions;
+		partitions->at(partitionOf(curr_context, key)).push_back(p);
+	}
+	else
+	{
+		curr_context->interVec->push_back(p);
+		if (curr_context->canSpill && !curr_context->spilling)
+		{
+			curr_context->interBytes += curr_context->client->pairSize(p);
+			if (curr_context->interBytes > curr_context->jobContext->threadBudget)
+			{
+				spillPhase(curr_context);
+			}
+		}
+	}
+}
+
+void emit3(K3 *key, V3 *value, void *context)
+{
+	auto curr_context = (ThreadContext *) context;
+	auto p = OutputPair(key, value);
+	// Each thread appends to its own buffer, no synchronization needed.
+	curr_context->outputBuffer->push_back(p);
+}
+
+void emitDense(unsigned long key, uint64_t value, void *context)
+{
+	auto curr_context = (ThreadContext *) context;
+	if (key >= curr_context->denseCounts->size())
+	{
+		fprintf(stderr, "emitDense: error on key out of the domain");
+		exit(1);
+	}
+	(*curr_context->denseCounts)[key]++;
+	(*curr_context->denseSums)[key] += value;
+}
+
+void *jobAlloc(std::size_t size, void *context)
+{
+	return ((ThreadContext *) context)->arena->allocate(size);
+}
+
+void jobAtClose(void *object, void (*destroy)(void *), void *context)
+{
+	((ThreadContext *) context)->arena->atFree(object, destroy);
+}
+
+// Mapping
+void mapPhase(ThreadContext *context)
+{
+	context->jobContext->currentStage.store(MAP_STAGE);
+	unsigned long start, end;
+	// Balanced by stealing, not by a shared counter.
+	while (context->inputRanges->claim(context->threadNum, &start, &end))
+	{
+		for (unsigned long i = start; i < end; ++i)
+		{
+			// Map each pair.
+			const InputPair &currPair = (*context->inputVec)[i];
+			context->client->map(currPair.first, currPair.second, context);
+		}
+		// Update percentage.
+		unsigned long mapped = context->jobContext->mappedCount.fetch_add(end - start) + end - start;
+		context->jobContext->percentage.store(mapped / (float) context->inputVec->size() * 100);
+	}
+}
+
+// Sorting.
+void sortPhase(ThreadContext *context)
+{
+	context->prefixKind = sortRun(context->interVec, context->prefixes);
+}
+
+/**
+ * @brief Runs the client's combiner on every group of a sorted run.
+ * The combined pairs are emitted back into the same run, which stays sorted as combine keeps the key.
+ * @return false, with the run untouched, if the client has no combiner.
+ */
+bool combineRun(ThreadContext *context, IntermediateVec *run, const uint64_t *prefixes, prefix_t kind)
+{
+	IntermediateVec sorted;
+	sorted.swap(*run);
+	auto groupBegin = sorted.begin();
+	while (groupBegin != sorted.end())
+	{
+		auto next = groupEnd(groupBegin, sorted.end(), prefixes, kind);
+		IntermediateVec group(groupBegin, next);
+		if (!context->client->combine(&group, context))
+		{
+			// Only the first group can find there's no combiner, nothing was emitted yet.
+			sorted.swap(*run);
+			return false;
+		}
+		if (kind != NO_PREFIX)
+		{
+			prefixes += next - groupBegin;
+		}
+		groupBegin = next;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Collapses equal keys emitted by this thread with the client's combiner, before shuffling.
+ * The combiner emits into interVec while its prefixes are walked, so its emits never spill.
+ */
+void combinePhase(ThreadContext *context)
+{
+	if (!hashPartitioned(context))
+	{
+		context->spilling = true;
+		bool combined = combineRun(context, context->interVec, context->prefixes->data(), context->prefixKind);
+		context->spilling = false;
+		if (combined && context->prefixKind != NO_PREFIX)
+		{
+			context->prefixKind = fillPrefixes(context->interVec, context->prefixes);
+		}
+		return;
+	}
+	for (IntermediateVec &partition:*context->partitions)
+	{
+		if (partition.empty())
+		{
+			continue;
+		}
+		vector<uint64_t> keys;
+		prefix_t kind = groupRun(&partition, &keys);
+		if (!combineRun(context, &partition, keys.data(), kind))
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Opens a new temporary file for a spilled run.
+ */
+SpillRun newRun()
+{
+	SpillRun run = {tmpfile(), 0};
+	if (run.file == nullptr)
+	{
+		fprintf(stderr, "Spill: error on tmpfile");
+		exit(1);
+	}
+	return run;
+}
+
+/**
+ * @brief Writes the sorted intermediate vector of this thread to a new spilled run.
+ */
+void writeRun(ThreadContext *context)
+{
+	SpillRun run = newRun();
+	for (const IntermediatePair &pair:*context->interVec)
+	{
+		if (!context->client->spill(pair, run.file))
+		{
+			// Only the first pair can find the client can't spill, the pairs stay in memory.
+			fclose(run.file);
+			context->canSpill = false;
+			return;
+		}
+		run.size++;
+	}
+	context->interVec->clear();
+	context->prefixes->clear();
+	context->prefixKind = NO_PREFIX;
+	context->interBytes = 0;
+	context->spillRuns->push_back(run);
+}
+
+/**
+ * @brief Sorts, combines and spills the intermediate vector once it goes over the thread's budget.
+ */
+void spillPhase(ThreadContext *context)
+{
+	sortPhase(context);
+	context->spilling = true;
+	combineRun(context, context->interVec, context->prefixes->data(), context->prefixKind);
+	context->spilling = false;
+	writeRun(context);
+}
+
+/**
+ * @brief Head of a sorted run being merged from disk, or from memory for threads that never spilled.
+ */
+typedef struct MergeSource
+{
+	IntermediatePair head;
+	// File of a spilled run, nullptr for an in-memory run.
+	std::FILE *file;
+	// Pairs left in the file.
+	unsigned long remaining;
+	// Pairs left in memory.
+	IntermediateVec::iterator curr;
+	IntermediateVec::iterator end;
+} MergeSource;
+
+// Source reading a spilled run from its start.
+MergeSource fileSource(const SpillRun &run)
+{
+	rewind(run.file);
+	MergeSource source = {IntermediatePair(), run.file, run.size, IntermediateVec::iterator(),
+						  IntermediateVec::iterator()};
+	return source;
+}
+
+// Source reading an in-memory run.
+MergeSource memorySource(IntermediateVec *run)
+{
+	MergeSource source = {IntermediatePair(), nullptr, 0, run->begin(), run->end()};
+	return source;
+}
+
+/**
+ * @brief Moves a source to its next pair. A spilled run's file is closed, and so deleted, once read.
+ * @return false once the source is exhausted.
+ */
+bool advanceSource(const MapReduceClient *client, MergeSource *source)
+{
+	if (source->file != nullptr)
+	{
+		if (source->remaining == 0)
+		{
+			fclose(source->file);
+			return false;
+		}
+		source->remaining--;
+		source->head = client->unspill(source->file);
+		return true;
+	}
+	if (source->curr == source->end)
+	{
+		return false;
+	}
+	source->head = *source->curr++;
+	return true;
+}
+
+// Heap order for merging sources: the source with the smallest head is on top.
+bool compareSources(const MergeSource &a, const MergeSource &b)
+{ return b.head.first->operator<(*a.head.first); }
+
+/**
+ * @brief Merges sorted sources, calling handlePair on every pair in key order.
+ */
+template<class Handler>
+void mergeSources(const MapReduceClient *client, vector<MergeSource> &sources, Handler handlePair)
+{
+	vector<MergeSource> heap;
+	for (MergeSource &source:sources)
+	{
+		if (advanceSource(client, &source))
+		{
+			heap.push_back(source);
+		}
+	}
+	std::make_heap(heap.begin(), heap.end(), compareSources);
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), compareSources);
+		MergeSource &top = heap.back();
+		handlePair(top.head);
+		if (advanceSource(client, &top))
+		{
+			std::push_heap(heap.begin(), heap.end(), compareSources);
+		}
+		else
+		{
+			heap.pop_back();
+		}
+	}
+}
+
+/**
+ * @brief Sizes the next merge pass, one output run per batch of MERGE_FAN_IN runs.
+ */
+void prepareMergePass(JobContext *jobContext)
+{
+	jobContext->nextRuns->assign((jobContext->mergeRuns->size() + MERGE_FAN_IN - 1) / MERGE_FAN_IN, SpillRun());
+	jobContext->mergeCounter = 0;
+}
+
 /**
- * @brief Context of a thread.
+ * @brief Collects the runs of all threads for merging, in a job where some thread spilled.
  */
-typedef struct ThreadContext
+void startSpillMerge(JobContext *jobContext)
 {
-	// Job that spawned the thread.
-	JobContext *jobContext;
-	// Number of thread given upon initialization.
-	int threadNum;
-	// Input vector given by client.
-	InputVec inputVec;
-	// Intermediate vector.
-	vector<IntermediatePair> *interVec;
-	// Semaphore.
-	sem_t *sem;
-	// Atomic counter.
-	std::atomic<int> *atomicCounter;
-	// Output vector.
-	OutputVec *outputVec;
-	// Client.
-	const MapReduceClient *client;
-	// Barrier.
-	Barrier *barrier;
-	// Mutex.
-	pthread_mutex_t *mutex;
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		jobContext->mergeRuns->insert(jobContext->mergeRuns->end(), tc->spillRuns->begin(), tc->spillRuns->end());
+		tc->spillRuns->clear();
+	}
+	prepareMergePass(jobContext);
+	// The merging thread is the only producer.
+	jobContext->groupQueue = new GroupQueue(QUEUED_GROUPS_PER_THREAD * jobContext->threads->size(), 1);
+}
 
-	// Ctor.
-	ThreadContext(JobContext *_jobContext, int _threadNum, const InputVec &_inputVec, sem_t *_sem,
-				  std::atomic<int> *_atomicCounter, OutputVec &_outputVec, const MapReduceClient *_client,
-				  Barrier *_barrier, pthread_mutex_t *_mutex) :
-			jobContext(_jobContext), threadNum(_threadNum), inputVec(_inputVec),
-			interVec(new IntermediateVec()), sem(_sem), atomicCounter(_atomicCounter),
-			outputVec(&_outputVec), client(_client), barrier(_barrier), mutex(_mutex)
-	{}
+/**
+ * @brief One merge pass: merges batches of spilled runs into longer runs. Threads claim batches by index.
+ * Passes repeat until a single merge can take all the runs that are left.
+ */
+void mergePassPhase(ThreadContext *context)
+{
+	JobContext *jobContext = context->jobContext;
+	unsigned long batch;
+	while ((batch = jobContext->mergeCounter.fetch_add(1)) < jobContext->nextRuns->size())
+	{
+		unsigned long batchEnd = std::min(jobContext->mergeRuns->size(), (batch + 1) * MERGE_FAN_IN);
+		vector<MergeSource> sources;
+		for (unsigned long i = batch * MERGE_FAN_IN; i < batchEnd; ++i)
+		{
+			sources.push_back(fileSource(jobContext->mergeRuns->at(i)));
+		}
+		SpillRun merged = newRun();
+		mergeSources(context->client, sources, [&](const IntermediatePair &pair)
+		{
+			context->client->spill(pair, merged.file);
+			merged.size++;
+		});
+		jobContext->nextRuns->at(batch) = merged;
+	}
+}
 
-} ThreadContext;
+void reduceGroup(ThreadContext *context, const IntermediatePair *begin, const IntermediatePair *end);
 
 /**
- * @brief Context of a job.
+ * @brief Reduces a group taken off the group queue, and frees the vector holding it, if any.
  */
-typedef struct JobContext
+void reduceQueued(ThreadContext *context, const QueuedGroup &group)
 {
-	// Vector of threads alive within this job.
-	vector<ThreadContext *> *threads{};
-	pthread_t *threadArr;
-	// State of the current job.
-	JobState *state;
+	reduceGroup(context, group.begin, group.end);
+	delete group.owner;
+}
 
-	// Ctor for a JobContext instance. Receives _threads as pointer.
-	JobContext(vector<ThreadContext *> *_threads, pthread_t *_threadArr) : threads(_threads), threadArr(_threadArr)
+/**
+ * @brief Hands a group to the reducers.
+ * While the queue is full the producing thread reduces queued groups itself, so it never waits.
+ */
+void queueGroup(ThreadContext *context, const QueuedGroup &group)
+{
+	GroupQueue *groupQueue = context->jobContext->groupQueue;
+	QueuedGroup queued;
+	while (!groupQueue->push(group))
 	{
-		// Inits state.
-		state = new JobState();
-		// Sets state.
-		state->stage = UNDEFINED_STAGE;
-		state->percentage = 0;
+		if (groupQueue->tryPop(&queued))
+		{
+			reduceQueued(context, queued);
+		}
 	}
+}
 
-	~JobContext()
+/**
+ * @brief Reduces queued groups until the queue is drained and no thread is producing any more.
+ */
+void reduceQueuedPhase(ThreadContext *context)
+{
+	QueuedGroup group;
+	while (context->jobContext->groupQueue->pop(&group))
 	{
-		if (!threads->empty())
-		{
-			delete threads->back()->barrier;
-			delete threads->back()->mutex;
-			delete threads->back()->atomicCounter;
-			delete threads->back()->sem;
-		}
-		for (ThreadContext *tc:*threads)
+		reduceQueued(context, group);
+	}
+}
+
+/**
+ * @brief Final merge of a spilled job, streaming its groups to the reducers as they are found.
+ * Merges the spilled runs left with the in-memory runs of threads that never spilled.
+ */
+void streamGroupsPhase(ThreadContext *context)
+{
+	JobContext *jobContext = context->jobContext;
+	vector<MergeSource> sources;
+	for (const SpillRun &run:*jobContext->mergeRuns)
+	{
+		sources.push_back(fileSource(run));
+	}
+	jobContext->mergeRuns->clear();
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		sources.push_back(memorySource(tc->interVec));
+	}
+
+	auto *group = new IntermediateVec();
+	mergeSources(context->client, sources, [&](const IntermediatePair &pair)
+	{
+		if (!group->empty() && *group->front().first < *pair.first)
 		{
-			delete tc->interVec;
-			delete tc;
+			queueGroup(context, QueuedGroup{group->data(), group->data() + group->size(), group});
+			group = new IntermediateVec();
 		}
-		delete threads;
-		delete[] threadArr;
-		delete state;
+		group->push_back(pair);
+	});
+	if (!group->empty())
+	{
+		queueGroup(context, QueuedGroup{group->data(), group->data() + group->size(), group});
 	}
-} JobContext;
+	else
+	{
+		delete group;
+	}
+	jobContext->groupQueue->removeProducer();
+}
 
+/**
+ * @brief Samples this thread's sorted run at evenly spaced positions, one sample per thread.
+ */
+void samplePhase(ThreadContext *context)
+{
+	auto threadCount = (unsigned long) context->jobContext->threads->size();
+	unsigned long runSize = context->interVec->size();
+	context->samples->clear();
+	for (unsigned long i = 0; i < threadCount && runSize > 0; ++i)
+	{
+		context->samples->push_back(context->interVec->at(i * runSize / threadCount).first);
+	}
+}
 
 /**
- * @brief Emits pairs into context = intermediate vector.
+ * @brief Picks the keys that split the intermediate key space between the threads, out of the
+ * samples of all runs, so each thread gets a similar share of pairs.
  */
-void emit2(K2 *key, V2 *value, void *context)
+void splitPhase(JobContext *jobContext)
 {
-	auto *interVec = (vector<IntermediatePair> *) context;
-	auto p = IntermediatePair(key, value);
-	interVec->push_back(p);
+	auto threadCount = (unsigned long) jobContext->threads->size();
+	vector<K2 *> samples;
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		samples.insert(samples.end(), tc->samples->begin(), tc->samples->end());
+	}
+	std::sort(samples.begin(), samples.end(), compareKeys);
+	jobContext->splitters->clear();
+	for (unsigned long i = 1; i < threadCount && !samples.empty(); ++i)
+	{
+		jobContext->splitters->push_back(samples.at(i * samples.size() / threadCount));
+	}
 }
 
-void emit3(K3 *key, V3 *value, void *context)
+/**
+ * @brief Cursor over the part of a sorted run that falls into this thread's key range.
+ */
+typedef struct RunCursor
 {
-	auto curr_context = (ThreadContext *) context;
-	auto p = OutputPair(key, value);
-	curr_context->outputVec->push_back(p);
+	IntermediateVec::iterator curr;
+	IntermediateVec::iterator end;
+	// Prefix of the key at curr, nullptr if the run has no prefixes.
+	const uint64_t *prefix;
+	// How the prefixes relate to the keys.
+	prefix_t kind;
+} RunCursor;
 
+// Heap order for the k-way merge: the cursor with the smallest key is on top.
+bool compareCursors(const RunCursor &a, const RunCursor &b)
+{
+	if (a.prefix != nullptr && b.prefix != nullptr && a.kind == b.kind)
+	{
+		if (*a.prefix != *b.prefix)
+		{
+			return *b.prefix < *a.prefix;
+		}
+		return lessKeys(b.curr->first, a.curr->first, a.kind);
+	}
+	return b.curr->first->operator<(*a.curr->first);
 }
 
-// Mapping
-void mapPhase(ThreadContext *context)
+/**
+ * @brief First pair of a sorted run whose key is not less than key. Pairs with another prefix than
+ * the key's are ordered by the prefix alone, so operator< is only called on the pairs sharing it.
+ */
+IntermediateVec::iterator lowerBound(IntermediateVec *run, const vector<uint64_t> *prefixes, prefix_t kind,
+									 IntermediateVec::iterator from, K2 *key)
 {
-	context->jobContext->state->stage = MAP_STAGE;
-	vector<IntermediatePair> *interVec = context->interVec;
-	int oldValue;
-	// Use atomic to avoid race conditions.
-	while ((unsigned long int) context->atomicCounter->load() < context->inputVec.size())
+	uint64_t prefix;
+	if (kind != NO_PREFIX && prefixes->size() == run->size())
 	{
-		oldValue = (*(context->atomicCounter))++;
-		InputPair currPair = context->inputVec.at(static_cast<unsigned int>(oldValue));
-		// Map each pair.
-		context->client->map(currPair.first, currPair.second, interVec);
-		// Update percentage.
-		context->jobContext->state->percentage = ((oldValue + 1) / (float) context->inputVec.size() * 100);
+		readPrefix(key, kind, prefix);
+		auto prefixBegin = prefixes->begin() + (from - run->begin());
+		auto range = std::equal_range(prefixBegin, prefixes->end(), prefix);
+		return std::lower_bound(run->begin() + (range.first - prefixes->begin()),
+								run->begin() + (range.second - prefixes->begin()), key,
+								[kind](const IntermediatePair &pair, const K2 *k)
+								{ return lessKeys(pair.first, k, kind); });
 	}
+	return std::lower_bound(from, run->end(), IntermediatePair(key, nullptr), comparePtrToPair);
 }
 
-// Sorting.
-void sortPhase(ThreadContext *context)
+/**
+ * @brief Finds this thread's slice of every sorted run. Done for all threads before any merges,
+ * since reducing may release keys the searches of other threads would read.
+ */
+void slicePhase(ThreadContext *context)
 {
-	std::sort(context->interVec->begin(), context->interVec->end(), comparePtrToPair);
+	JobContext *jobContext = context->jobContext;
+	vector<K2 *> *splitters = jobContext->splitters;
+	auto rangeNum = (unsigned long) context->threadNum;
+	context->slices->clear();
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		IntermediateVec *run = tc->interVec;
+		auto begin = run->begin();
+		auto end = run->end();
+		if (rangeNum > 0)
+		{
+			begin = rangeNum - 1 < splitters->size() ?
+					lowerBound(run, tc->prefixes, tc->prefixKind, run->begin(), splitters->at(rangeNum - 1)) :
+					run->end();
+		}
+		if (rangeNum < splitters->size())
+		{
+			end = lowerBound(run, tc->prefixes, tc->prefixKind, begin, splitters->at(rangeNum));
+		}
+		context->slices->push_back(pair<unsigned long, unsigned long>(begin - run->begin(), end - run->begin()));
+	}
 }
 
-void shufflePhase(vector<IntermediateVec> *reduceQueue, ThreadContext *context)
+/**
+ * @brief Merges this thread's key range out of all sorted runs and queues its groups for reducing as the
+ * merge completes them, SHUFFLE_BATCH_SIZE pairs at a time. Thread i owns the keys in
+ * [splitters[i - 1], splitters[i]), so equal keys never cross threads. Threads done with their own range
+ * reduce the groups others queue while still shuffling. A thread waiting for groups holds its worker, but
+ * only waits for threads that are running: threads of the stage that start later reduce their own groups.
+ * In SAMPLE_SORT_SHUFFLE jobs the thread reduces its groups right away, in key order.
+ */
+void shufflePhase(ThreadContext *context)
 {
-	context->jobContext->state->stage = REDUCE_STAGE;
+	JobContext *jobContext = context->jobContext;
+	bool reduceInOrder = jobContext->options.shuffle == SAMPLE_SORT_SHUFFLE;
+	if (!reduceInOrder)
+	{
+		jobContext->groupQueue->addProducer();
+	}
 
-	// Throw all pairs into a single vector.
-	IntermediateVec newInter;
-	for (ThreadContext *tc:*context->jobContext->threads)
+	// Start at this thread's slice of every run.
+	vector<RunCursor> heap;
+	unsigned long mergedSize = 0;
+	prefix_t kind = NO_PREFIX;
+	bool sameKind = true;
+	for (unsigned long i = 0; i < jobContext->threads->size(); ++i)
 	{
-		newInter.insert(newInter.begin(), tc->interVec->begin(), tc->interVec->end());
+		ThreadContext *tc = jobContext->threads->at(i);
+		IntermediateVec *run = tc->interVec;
+		RunCursor cursor = {run->begin() + context->slices->at(i).first, run->begin() + context->slices->at(i).second,
+							nullptr, tc->prefixKind};
+		if (tc->prefixKind != NO_PREFIX)
+		{
+			cursor.prefix = tc->prefixes->data() + (cursor.curr - run->begin());
+		}
+		if (cursor.curr != cursor.end)
+		{
+			sameKind = sameKind && (heap.empty() || cursor.kind == kind);
+			kind = cursor.kind;
+			mergedSize += cursor.end - cursor.curr;
+			heap.push_back(cursor);
+		}
 	}
-	std::sort(newInter.begin(), newInter.end(), comparePtrToPair);
 
-	// Go over all pairs.
-	K2 *k2max = newInter.back().first;
-	IntermediatePair *currPair = &newInter.back();
-	IntermediateVec currVec;
-	while (!newInter.empty())
+	// K-way merge of the slices. Prefixes are merged along, to group by.
+	if (!sameKind)
+	{
+		kind = NO_PREFIX;
+	}
+	IntermediateVec &merged = *context->merged;
+	vector<uint64_t> mergedPrefixes;
+	merged.reserve(mergedSize);
+	if (kind != NO_PREFIX)
 	{
-		if (*currPair->first < *k2max)
+		mergedPrefixes.reserve(mergedSize);
+	}
+	std::make_heap(heap.begin(), heap.end(), compareCursors);
+	// Pairs before handed are in groups handed out already.
+	unsigned long handed = 0;
+	while (!heap.empty())
+	{
+		for (unsigned long i = 0; i < SHUFFLE_BATCH_SIZE && !heap.empty(); ++i)
 		{
-			if (pthread_mutex_lock(context->mutex) != 0)
+			std::pop_heap(heap.begin(), heap.end(), compareCursors);
+			RunCursor &top = heap.back();
+			merged.push_back(*top.curr);
+			if (kind != NO_PREFIX)
+			{
+				mergedPrefixes.push_back(*top.prefix);
+			}
+			if (top.prefix != nullptr)
 			{
-				fprintf(stderr, "Shuffle: error on pthread_mutex_lock");
-				exit(1);
+				top.prefix++;
 			}
-			reduceQueue->push_back(currVec);
-			sem_post(context->sem);
-			if (pthread_mutex_unlock(context->mutex) != 0)
+			if (++top.curr == top.end)
 			{
-				fprintf(stderr, "Shuffle: error on pthread_mutex_unlock");
-				exit(1);
+				heap.pop_back();
+			}
+			else
+			{
+				std::push_heap(heap.begin(), heap.end(), compareCursors);
 			}
-			currVec = IntermediateVec();
-			k2max = currPair->first;
 		}
-		currVec.push_back(*currPair);
-		newInter.pop_back();
-		currPair = &newInter.back();
-	}
-
 
-	if (pthread_mutex_lock(context->mutex) != 0)
-	{
-		fprintf(stderr, "Shuffle: error on pthread_mutex_lock");
-		exit(1);
+		// Hand out the groups of equal keys merged so far, viewed in place: merged never reallocates. The
+		// last group may go on in the next batch, so it waits for the merge to pass it.
+		auto groupBegin = merged.begin() + handed;
+		while (groupBegin != merged.end())
+		{
+			auto next = groupEnd(groupBegin, merged.end(),
+								 kind != NO_PREFIX ? mergedPrefixes.data() + handed : nullptr, kind);
+			if (next == merged.end() && !heap.empty())
+			{
+				break;
+			}
+			QueuedGroup group = {&*groupBegin, &*groupBegin + (next - groupBegin), nullptr};
+			if (reduceInOrder)
+			{
+				reduceGroup(context, group.begin, group.end);
+			}
+			else
+			{
+				queueGroup(context, group);
+			}
+			handed = next - merged.begin();
+			groupBegin = next;
+		}
 	}
-	if (!currVec.empty())
+	if (!reduceInOrder)
 	{
-		reduceQueue->push_back(currVec);
-		sem_post(context->sem);
+		jobContext->groupQueue->removeProducer();
+		reduceQueuedPhase(context);
+	}
+}
 
+/**
+ * @brief Switches the job to the reduce stage, once all pairs are mapped.
+ */
+void startReduceStage(JobContext *jobContext)
+{
+	jobContext->pairCount = 0;
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		jobContext->pairCount += tc->interVec->size();
+		for (const IntermediateVec &partition:*tc->partitions)
+		{
+			jobContext->pairCount += partition.size();
+		}
+		for (const SpillRun &run:*tc->spillRuns)
+		{
+			jobContext->pairCount += run.size;
+			jobContext->spilled = true;
+		}
+		// Aggregated keys count like pairs.
+		for (const AggregateTable &table:*tc->tables)
+		{
+			jobContext->pairCount += table.size();
+		}
 	}
-	if (pthread_mutex_unlock(context->mutex) != 0)
+	// So do the keys of a dense domain.
+	jobContext->pairCount += jobContext->denseDomain;
+	jobContext->percentage.store(0);
+	jobContext->currentStage.store(REDUCE_STAGE);
+}
+
+/**
+ * @brief Adds count pairs to the reduce progress.
+ */
+void addReduced(JobContext *jobContext, unsigned long count)
+{
+	unsigned long reduced = jobContext->reducedCount.fetch_add(count) + count;
+	// 100% is only reported once the output is spliced.
+	if (reduced < jobContext->pairCount)
 	{
-		fprintf(stderr, "Shuffle: error on pthread_mutex_unlock");
-		exit(1);
+		jobContext->percentage.store(reduced / (float) jobContext->pairCount * 100);
 	}
+}
 
+/**
+ * @brief Reduces the group in [begin, end) and updates the progress.
+ */
+void reduceGroup(ThreadContext *context, const IntermediatePair *begin, const IntermediatePair *end)
+{
+	context->client->reduceRange(begin, end, context);
+	addReduced(context->jobContext, (unsigned long) (end - begin));
 }
 
-// Reducing
-void reducePhase(vector<IntermediateVec> *reduceQueue, int reduceSize, ThreadContext *context)
+/**
+ * @brief Sums this thread's slice of a DenseClient's key domain over the arrays of every thread, and
+ * reduces the keys emitted at least once, in key order. Thread i owns the i-th of equal slices.
+ */
+void densePhase(ThreadContext *context)
 {
-	while (!reduceQueue->empty())
+	JobContext *jobContext = context->jobContext;
+	unsigned long threadCount = jobContext->threads->size();
+	unsigned long start = jobContext->denseDomain * context->threadNum / threadCount;
+	unsigned long end = jobContext->denseDomain * (context->threadNum + 1) / threadCount;
+	uint64_t *counts = context->denseCounts->data();
+	uint64_t *sums = context->denseSums->data();
+	for (ThreadContext *tc:*jobContext->threads)
 	{
-		sem_wait(context->sem);
-
-		if (pthread_mutex_lock(context->mutex) != 0)
+		if (tc == context)
+		{
+			continue;
+		}
+		const uint64_t *otherCounts = tc->denseCounts->data();
+		const uint64_t *otherSums = tc->denseSums->data();
+		for (unsigned long key = start; key < end; ++key)
+		{
+			counts[key] += otherCounts[key];
+		}
+		for (unsigned long key = start; key < end; ++key)
+		{
+			sums[key] += otherSums[key];
+		}
+	}
+	for (unsigned long key = start; key < end; ++key)
+	{
+		if (counts[key] != 0)
 		{
-			fprintf(stderr, "Reduce: error on pthread_mutex_lock");
-			exit(1);
+			jobContext->dense->reduceDense(key, counts[key], sums[key], context);
 		}
+	}
+	addReduced(jobContext, end - start);
+}
 
-		if (!reduceQueue->empty())
+/**
+ * @brief Merges the partial results of the keys this thread finalizes out of every thread's table,
+ * then finalizes them. Thread i finalizes the keys whose hash is i modulo the number of threads.
+ */
+void aggregatePhase(ThreadContext *context)
+{
+	JobContext *jobContext = context->jobContext;
+	const AggregateClient *aggregator = jobContext->aggregator;
+	auto threadNum = (unsigned long) context->threadNum;
+	AggregateTable &table = context->tables->at(threadNum);
+	unsigned long ownKeys = table.size();
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		if (tc == context)
 		{
-			context->client->reduce(&reduceQueue->back(), context);
-			reduceQueue->pop_back();
-			context->jobContext->state->percentage = (reduceSize - reduceQueue->size()) / (float) reduceSize * 100;
+			continue;
 		}
-		else
+		AggregateTable &other = tc->tables->at(threadNum);
+		for (const AggregateTable::Entry &entry:other.slots())
+		{
+			if (entry.key == nullptr)
+			{
+				continue;
+			}
+			bool inserted;
+			AggregateTable::Entry *into = table.find(entry.key, entry.hash, &inserted);
+			if (inserted)
+			{
+				into->partial = entry.partial;
+			}
+			else
+			{
+				if (jobContext->counter != nullptr)
+				{
+					CountAggregator::add(into->partial, (uintptr_t) entry.partial);
+				}
+				else
+				{
+					aggregator->merge(into->partial, entry.partial);
+				}
+				aggregator->releaseKey(entry.key);
+			}
+		}
+		addReduced(jobContext, other.size());
+		other.clear();
+	}
+	for (const AggregateTable::Entry &entry:table.slots())
+	{
+		if (entry.key != nullptr)
 		{
-			sem_post(context->sem);
+			aggregator->finalize(entry.key, entry.partial, context);
 		}
+	}
+	addReduced(jobContext, ownKeys);
+	table.clear();
+}
 
-		if (pthread_mutex_unlock(context->mutex) != 0)
+/**
+ * @brief Groups and reduces the hash partitions owned by this thread, in HASH_SHUFFLE jobs and
+ * SORT_SHUFFLE jobs with hashable keys.
+ * Thread i owns every partition p with p % threads == i, gathered from all threads.
+ */
+void reducePartitionsPhase(ThreadContext *context)
+{
+	vector<ThreadContext *> *threads = context->jobContext->threads;
+	unsigned long partitionCount = context->partitions->size();
+	for (auto p = (unsigned long) context->threadNum; p < partitionCount; p += threads->size())
+	{
+		IntermediateVec partition;
+		for (ThreadContext *tc:*threads)
 		{
-			fprintf(stderr, "Reduce: error on pthread_mutex_lock");
-			exit(1);
+			IntermediateVec &bucket = tc->partitions->at(p);
+			partition.insert(partition.end(), bucket.begin(), bucket.end());
+			IntermediateVec().swap(bucket);
 		}
+		vector<uint64_t> keys;
+		prefix_t kind = groupRun(&partition, &keys);
+
+		forEachGroup(partition.begin(), partition.end(), keys.data(), kind,
+					 [&](IntermediateVec::iterator groupBegin, IntermediateVec::iterator groupEnd)
+					 {
+						 reduceGroup(context, &*groupBegin, &*groupBegin + (groupEnd - groupBegin));
+					 });
 	}
 }
 
 /**
- * @brief The main function of each thread.
+ * @brief Picks where each thread's output buffer goes in the client's output vector.
  */
-void threadMapReduce(ThreadContext *context)
+void planOutputPhase(JobContext *jobContext)
 {
-	mapPhase(context);
-	sortPhase(context);
-	context->barrier->barrier(); // waiting for unlock.
-	auto *reduceQueue = new vector<IntermediateVec>();
-	if (context->threadNum == 0)
+	unsigned long offset = jobContext->outputVec->size();
+	jobContext->outputOffsets->clear();
+	for (ThreadContext *tc:*jobContext->threads)
 	{
-		shufflePhase(reduceQueue, context);
+		jobContext->outputOffsets->push_back(offset);
+		offset += tc->outputBuffer->size();
 	}
-	reducePhase(reduceQueue, reduceQueue->size(), context);
-	delete reduceQueue;
+	jobContext->outputVec->resize(offset);
 }
 
-JobHandle startMapReduceJob(const MapReduceClient &client, const InputVec &inputVec, OutputVec &outputVec,
-							int multiThreadLevel)
+/**
+ * @brief Copies this thread's output buffer into its slice of the client's output vector.
+ */
+void spliceOutputPhase(ThreadContext *context)
 {
-	auto *sem = new sem_t();
+	unsigned long offset = context->jobContext->outputOffsets->at((unsigned long) context->threadNum);
+	std::copy(context->outputBuffer->begin(), context->outputBuffer->end(), context->outputVec->begin() + offset);
+	OutputVec().swap(*context->outputBuffer);
+}
 
-	// atomic counter to be used as input vec index.
-	auto *atomic_counter = new std::atomic<int>(0);
-	auto *threads = new vector<ThreadContext *>();
-	auto *threadArr = new pthread_t[multiThreadLevel];
-	auto *jobContext = new JobContext(threads, threadArr);
-	auto *barrier = new Barrier(multiThreadLevel);
-	auto *mutex = new pthread_mutex_t(PTHREAD_MUTEX_INITIALIZER);
-	for (int i = 0; i < multiThreadLevel; ++i)
+/**
+ * @brief Runs a phase of the job on one thread.
+ */
+void JobContext::runStage(int stage, int threadNum)
+{
+	ThreadContext *context = threads->at((unsigned long) threadNum);
+	switch (stage)
 	{
-		ThreadContext *context = new ThreadContext(jobContext, i, inputVec, sem,
-												   atomic_counter, outputVec, &client,
-												   barrier, mutex);
-		threads->push_back(context);
-		pthread_create(threadArr + i, nullptr, (void *(*)(void *)) threadMapReduce, context);
+		case MAP_PHASE:
+			// Each thread touches its own arrays first.
+			context->denseCounts->assign(denseDomain, 0);
+			context->denseSums->assign(denseDomain, 0);
+			mapPhase(context);
+			if (!hashPartitioned(context))
+			{
+				sortPhase(context);
+			}
+			combinePhase(context);
+			if (!context->spillRuns->empty() && !context->interVec->empty())
+			{
+				// Once a thread spilled, all of its pairs are merged from disk.
+				writeRun(context);
+			}
+			if (!hashPartitioned(context))
+			{
+				samplePhase(context);
+			}
+			break;
+		case DENSE_PHASE:
+			densePhase(context);
+			break;
+		case AGGREGATE_PHASE:
+			aggregatePhase(context);
+			break;
+		case SLICE_PHASE:
+			slicePhase(context);
+			break;
+		case SHUFFLE_PHASE:
+			shufflePhase(context);
+			break;
+		case PARTITIONS_PHASE:
+			reducePartitionsPhase(context);
+			break;
+		case MERGE_PASS_PHASE:
+			mergePassPhase(context);
+			break;
+		case STREAM_PHASE:
+			if (threadNum == 0)
+			{
+				streamGroupsPhase(context);
+			}
+			// Only the merging thread reduces, in order, when the output is sorted.
+			if (threadNum == 0 || options.shuffle != SAMPLE_SORT_SHUFFLE)
+			{
+				reduceQueuedPhase(context);
+			}
+			break;
+		default:
+			// SAMPLE_SORT_SHUFFLE jobs reduce in the shuffle, their runs are only free once all threads merged.
+			IntermediateVec().swap(*context->interVec);
+			vector<uint64_t>().swap(*context->prefixes);
+			// Groups queued by this thread were views into merged, all of them are reduced by now.
+			IntermediateVec().swap(*context->merged);
+			// Dense arrays too, once all threads summed their slices.
+			vector<uint64_t>().swap(*context->denseCounts);
+			vector<uint64_t>().swap(*context->denseSums);
+			spliceOutputPhase(context);
+			break;
+	}
+}
+
+/**
+ * @brief Picks how the mapped pairs are shuffled, once aggregated keys are finalized.
+ */
+int shuffleStage(JobContext *jobContext)
+{
+	bool anyPairs = false;
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		anyPairs = anyPairs || !tc->interVec->empty() || !tc->spillRuns->empty();
+		for (const IntermediateVec &partition:*tc->partitions)
+		{
+			anyPairs = anyPairs || !partition.empty();
+		}
+	}
+	if (!anyPairs)
+	{
+		planOutputPhase(jobContext);
+		return SPLICE_PHASE;
+	}
+	if (jobContext->spilled)
+	{
+		startSpillMerge(jobContext);
+		return jobContext->mergeRuns->size() > MERGE_FAN_IN ? MERGE_PASS_PHASE : STREAM_PHASE;
+	}
+	if (jobContext->grouping.load() == HASH_GROUPING)
+	{
+		return PARTITIONS_PHASE;
+	}
+	splitPhase(jobContext);
+	if (jobContext->options.shuffle != SAMPLE_SORT_SHUFFLE)
+	{
+		// Shuffling threads join as producers.
+		jobContext->groupQueue = new GroupQueue(PIPELINED_GROUPS_PER_THREAD * jobContext->threads->size(), 0);
+	}
+	return SLICE_PHASE;
+}
+
+/**
+ * @brief Picks the phase after the dense keys are reduced: aggregated keys are finalized first.
+ */
+int aggregateStage(JobContext *jobContext)
+{
+	for (ThreadContext *tc:*jobContext->threads)
+	{
+		for (const AggregateTable &table:*tc->tables)
+		{
+			if (table.size() > 0)
+			{
+				return AGGREGATE_PHASE;
+			}
+		}
 	}
-	return jobContext;
+	return shuffleStage(jobContext);
 }
 
-void waitForJob(JobHandle job)
+/**
+ * @brief Runs once all threads finished a phase, picks the next one.
+ */
+int JobContext::finishStage(int stage)
 {
-	auto *jobContext = (JobContext *) job;
-	while (jobContext->state->stage != REDUCE_STAGE || jobContext->state->percentage < 100)
+	switch (stage)
 	{
+		case MAP_PHASE:
+			startReduceStage(this);
+			return dense != nullptr ? DENSE_PHASE : aggregateStage(this);
+		case DENSE_PHASE:
+			return aggregateStage(this);
+		case AGGREGATE_PHASE:
+			return shuffleStage(this);
+		case SLICE_PHASE:
+			return SHUFFLE_PHASE;
+		case SHUFFLE_PHASE:
+			// Every group is reduced by now.
+			planOutputPhase(this);
+			return SPLICE_PHASE;
+		case MERGE_PASS_PHASE:
+			mergeRuns->swap(*nextRuns);
+			prepareMergePass(this);
+			return mergeRuns->size() > MERGE_FAN_IN ? MERGE_PASS_PHASE : STREAM_PHASE;
+		case SPLICE_PHASE:
+			return JOB_DONE;
+		default:
+			planOutputPhase(this);
+			return SPLICE_PHASE;
 	}
 }
 
-void getJobState(JobHandle job, JobState *state)
+JobHandle startMapReduceJob(const MapReduceClient &client, const InputVec &inputVec, OutputVec &outputVec,
+							int multiThreadLevel)
 {
-	auto *jc = (JobContext *) job;
-	*state = *jc->state;
+	return startMapReduceJob(client, inputVec, outputVec, multiThreadLevel, JobOptions());
 }
 
-void closeJobHandle(JobHandle job)
+JobHandle startMapReduceJob(const MapReduceClient &client, const InputVec &inputVec, OutputVec &outputVec,
+							int multiThreadLevel, const JobOptions &options)
 {
-	waitForJob(job);
-	auto jobContext = (JobContext *) job;
-	for (int i = 0; i < (int)jobContext->threads->size(); ++i)
+	auto *threads = new vector<ThreadContext *>();
+	// Sorted output needs the pairs, aggregating clients are folded group by group there.
+	const AggregateClient *aggregator = nullptr;
+	CountAggregator *counter = nullptr;
+	if (options.shuffle != SAMPLE_SORT_SHUFFLE)
+	{
+		aggregator = dynamic_cast<const AggregateClient *>(&client);
+		if (aggregator == nullptr && client.countOnly())
+		{
+			aggregator = counter = new CountAggregator(client);
+		}
+	}
+	auto *jobContext = new JobContext(threads, multiThreadLevel, options, inputVec.size(), outputVec,
+										aggregator);
+	jobContext->counter = counter;
+	jobContext->dense = dynamic_cast<const DenseClient *>(&client);
+	if (jobContext->dense != nullptr)
 	{
-		pthread_join(jobContext->threadArr[i], nullptr);
+		jobContext->denseDomain = jobContext->dense->domainSize();
+	}
+	for (int i = 0; i < multiThreadLevel; ++i)
+	{
+		ThreadContext *context = new ThreadContext(jobContext, i, inputVec,
+												   jobContext->inputRanges, outputVec,
+												   &jobContext->outputBuffers[i].pairs, &client);
+		// SORT_SHUFFLE jobs may group by hash too.
+		context->partitions->resize(multiThreadLevel * PARTITIONS_PER_THREAD);
+		if (options.shuffle != HASH_SHUFFLE)
+		{
+			context->canSpill = options.memoryBudget > 0;
+		}
+		if (aggregator != nullptr)
+		{
+			context->tables->resize((unsigned long) multiThreadLevel);
+		}
+		threads->push_back(context);
 	}
-	delete jobContext;
+	return startParallelJob(jobContext, multiThreadLevel, options.weight);
 }
@@ -2,6 +2,10 @@
 #define MAPREDUCEFRAMEWORK_H
 
 #include "MapReduceClient.h"
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
 
 typedef void* JobHandle;
 
@@ -13,14 +17,73 @@ typedef struct {
 	float percentage;
 } JobState;
 
+// How intermediate pairs are brought together for reducing.
+// SORT_SHUFFLE: every thread sorts its pairs, threads merge key ranges of all sorted runs. Unless
+// the job may spill, jobs whose keys implement K2::hash and K2::equals, checked on the first key
+// emitted, are shuffled like HASH_SHUFFLE jobs instead.
+// HASH_SHUFFLE: emit2 scatters pairs into partitions by K2::hash, or MapReduceClient::partitionHash,
+// each thread groups and reduces the partitions it owns, with a hash table if the keys implement
+// K2::hash and K2::equals. Groups are not reduced in key order. Jobs whose keys implement neither hash,
+// checked on the first key emitted, are shuffled like SORT_SHUFFLE jobs instead.
+// SAMPLE_SORT_SHUFFLE: like SORT_SHUFFLE, but each thread reduces the key range it merged, in key
+// order, so the output comes out sorted by K2. Jobs that spill reduce on the merging thread instead.
+enum shuffle_t {SORT_SHUFFLE=0, HASH_SHUFFLE=1, SAMPLE_SORT_SHUFFLE=2};
+
+// Per job settings, see startMapReduceJob.
+typedef struct JobOptions {
+	shuffle_t shuffle;
+	// Bytes of intermediate pairs the job may keep in memory, split evenly between the threads,
+	// 0 for no limit. SORT_SHUFFLE and SAMPLE_SORT_SHUFFLE jobs whose client implements spill and
+	// unspill write sorted runs to temporary files when a thread goes over its share, and merge them
+	// back from disk.
+	unsigned long memoryBudget;
+	// Share of the cores the job gets while other jobs run, relative to their weights: a job of
+	// weight 4 runs about four times as many tasks as a job of weight 1. 1 by default, at least 1.
+	unsigned int weight;
+
+	JobOptions() : shuffle(SORT_SHUFFLE), memoryBudget(0), weight(1) {}
+} JobOptions;
+
 void emit2 (K2* key, V2* value, void* context);
 void emit3 (K3* key, V3* value, void* context);
+// Adds value to the key of a DenseClient, which must be below its domainSize.
+void emitDense(unsigned long key, std::uint64_t value, void* context);
+
+// Job arena, for allocating K2/V2/K3/V3 objects without a malloc per object.
+// Allocates from the arena of the calling thread, through the context given to map, combine or reduce.
+// Arena memory is freed all at once by closeJobHandle, so it must never be deleted, and objects read after
+// closeJobHandle (e.g. output pairs) must not come from it.
+void* jobAlloc(std::size_t size, void* context);
+// Runs destroy(object) when the job's arena is freed.
+void jobAtClose(void* object, void (*destroy)(void*), void* context);
+
+template<class T>
+void jobDestroy(void* object) {
+	static_cast<T*>(object)->~T();
+}
+
+// Constructs a T in the job arena, its destructor runs in closeJobHandle.
+template<class T, class... Args>
+T* jobNew(void* context, Args&&... args) {
+	T* object = new (jobAlloc(sizeof(T), context)) T(std::forward<Args>(args)...);
+	if (!std::is_trivially_destructible<T>::value) {
+		jobAtClose(object, jobDestroy<T>, context);
+	}
+	return object;
+}
 
 JobHandle startMapReduceJob(const MapReduceClient& client,
 	const InputVec& inputVec, OutputVec& outputVec,
 	int multiThreadLevel);
+JobHandle startMapReduceJob(const MapReduceClient& client,
+	const InputVec& inputVec, OutputVec& outputVec,
+	int multiThreadLevel, const JobOptions& options);
 
 void waitForJob(JobHandle job);
+// Waits at most timeoutMs milliseconds for the job. Returns whether the job is done.
+bool waitForJobFor(JobHandle job, unsigned int timeoutMs);
+// Descriptor that becomes readable (e.g. in epoll) once the job is done. Owned and closed by the job.
+int getJobEventFd(JobHandle job);
 void getJobState(JobHandle job, JobState* state);
 void closeJobHandle(JobHandle job);
 	
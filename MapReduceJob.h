@@ -0,0 +1,262 @@
+#ifndef MAPREDUCEJOB_H
+#define MAPREDUCEJOB_H
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include "JobEngine.h"
+
+// a typed MapReduce job: keys and values are stored by value and the client is called statically, so
+// comparisons and the client's map and reduce can be inlined. runs on the same threads as startMapReduceJob.
+//
+// the client implements:
+//   void map(const K1 &key, const V1 &value, Emitter<K2, V2> &emitter) const;
+//   void reduce(const std::pair<K2, V2> *begin, const std::pair<K2, V2> *end, Emitter<K3, V3> &emitter) const;
+// reduce gets all pairs of one key. K2 needs operator<, K3 and V3 must be default constructible.
+// the output is sorted by K2, like the rest of the framework's sort shuffle.
+
+template <typename K, typename V>
+class Emitter {
+public:
+	explicit Emitter(std::vector<std::pair<K, V> > &_pairs) : pairs(_pairs) {}
+	void emit(const K &key, const V &value) { pairs.emplace_back(key, value); }
+	void emit(K &&key, V &&value) { pairs.emplace_back(std::move(key), std::move(value)); }
+
+private:
+	std::vector<std::pair<K, V> > &pairs;
+};
+
+template <typename K1, typename V1, typename K2, typename V2, typename K3, typename V3, typename Client>
+class MapReduceJob : public ParallelTask {
+public:
+	typedef std::pair<K1, V1> InputPair;
+	typedef std::pair<K2, V2> IntermediatePair;
+	typedef std::pair<K3, V3> OutputPair;
+
+	// starts the job. input, output and client must outlive it, the handle is used like startMapReduceJob's.
+	static JobHandle start(const Client &client, const std::vector<InputPair> &input,
+						   std::vector<OutputPair> &output, int multiThreadLevel)
+	{
+		return start(client, input, output, multiThreadLevel, JobOptions());
+	}
+
+	// same, with the job's settings. typed jobs always sort in memory, so only the weight applies.
+	static JobHandle start(const Client &client, const std::vector<InputPair> &input,
+						   std::vector<OutputPair> &output, int multiThreadLevel, const JobOptions &options)
+	{
+		return startParallelJob(new MapReduceJob(client, input, output, multiThreadLevel), multiThreadLevel,
+								options.weight);
+	}
+
+	void runStage(int stage, int threadNum) override
+	{
+		switch (stage)
+		{
+			case MAP:
+				mapPhase(threadNum);
+				break;
+			case REDUCE:
+				reducePhase(threadNum);
+				break;
+			default:
+				splicePhase(threadNum);
+				break;
+		}
+	}
+
+	int finishStage(int stage) override
+	{
+		switch (stage)
+		{
+			case MAP:
+				splitPhase();
+				pairCount = 0;
+				for (const std::vector<IntermediatePair> &run:runs)
+				{
+					pairCount += run.size();
+				}
+				percentage.store(0);
+				state.store(REDUCE_STAGE);
+				return REDUCE;
+			case REDUCE:
+				planOutput();
+				return SPLICE;
+			default:
+				return JOB_DONE;
+		}
+	}
+
+	void getState(JobState *jobState) override
+	{
+		jobState->stage = state.load();
+		jobState->percentage = percentage.load();
+	}
+
+private:
+	enum { MAP, REDUCE, SPLICE };
+
+	const Client &client;
+	const std::vector<InputPair> &input;
+	std::vector<OutputPair> &output;
+	int threadCount;
+	// each thread's pairs, sorted once mapped.
+	std::vector<std::vector<IntermediatePair> > runs;
+	// each thread's output, spliced into output once all threads reduced.
+	std::vector<std::vector<OutputPair> > outputs;
+	std::vector<unsigned long> outputOffsets;
+	// thread i reduces the keys in [splitters[i - 1], splitters[i]).
+	std::vector<K2> splitters;
+	// where each thread's slice of a run starts, found before any thread moves pairs out of the runs.
+	std::vector<std::vector<unsigned long> > slices;
+	WorkRanges inputRanges;
+	std::atomic<unsigned long> mappedCount;
+	std::atomic<unsigned long> reducedCount;
+	unsigned long pairCount;
+	std::atomic<stage_t> state;
+	// progress of the current stage, like the classic jobs report it.
+	std::atomic<float> percentage;
+
+	MapReduceJob(const Client &_client, const std::vector<InputPair> &_input, std::vector<OutputPair> &_output,
+				 int _threadCount) :
+			client(_client), input(_input), output(_output), threadCount(_threadCount),
+			runs((unsigned long) _threadCount), outputs((unsigned long) _threadCount),
+			outputOffsets((unsigned long) _threadCount), inputRanges(_input.size(), _threadCount), mappedCount(0), reducedCount(0),
+			pairCount(0), state(MAP_STAGE), percentage(0)
+	{}
+
+	static bool compareKeys(const IntermediatePair &a, const IntermediatePair &b) { return a.first < b.first; }
+
+	static bool comparePairToKey(const IntermediatePair &pair, const K2 &key) { return pair.first < key; }
+
+	// a slice of a sorted run, used by the k-way merge.
+	typedef struct {
+		IntermediatePair *curr;
+		IntermediatePair *end;
+	} Cursor;
+
+	// heap order for the k-way merge: the cursor with the smallest key is on top.
+	static bool compareCursors(const Cursor &a, const Cursor &b) { return b.curr->first < a.curr->first; }
+
+	void mapPhase(int threadNum)
+	{
+		std::vector<IntermediatePair> &run = runs[threadNum];
+		Emitter<K2, V2> emitter(run);
+		unsigned long start, end;
+		while (inputRanges.claim(threadNum, &start, &end))
+		{
+			for (unsigned long i = start; i < end; ++i)
+			{
+				client.map(input[i].first, input[i].second, emitter);
+			}
+			unsigned long mapped = mappedCount.fetch_add(end - start) + end - start;
+			percentage.store(100 * (float) mapped / input.size());
+		}
+		std::sort(run.begin(), run.end(), compareKeys);
+	}
+
+	// picks threadCount - 1 splitters out of threadCount samples per sorted run, and slices the runs by them.
+	void splitPhase()
+	{
+		std::vector<const K2 *> samples;
+		for (const std::vector<IntermediatePair> &run:runs)
+		{
+			for (unsigned long i = 0; i < (unsigned long) threadCount && !run.empty(); ++i)
+			{
+				samples.push_back(&run[i * run.size() / threadCount].first);
+			}
+		}
+		std::sort(samples.begin(), samples.end(), [](const K2 *a, const K2 *b) { return *a < *b; });
+		for (unsigned long i = 1; i < (unsigned long) threadCount && !samples.empty(); ++i)
+		{
+			splitters.push_back(*samples[i * samples.size() / threadCount]);
+		}
+		for (const std::vector<IntermediatePair> &run:runs)
+		{
+			std::vector<unsigned long> bounds(1, 0);
+			for (const K2 &splitter:splitters)
+			{
+				bounds.push_back(std::lower_bound(run.begin() + bounds.back(), run.end(), splitter,
+												  comparePairToKey) - run.begin());
+			}
+			bounds.resize((unsigned long) threadCount + 1, run.size());
+			slices.push_back(bounds);
+		}
+	}
+
+	// merges this thread's key range out of all runs and reduces it group by group.
+	void reducePhase(int threadNum)
+	{
+		std::vector<Cursor> heap;
+		unsigned long mergedSize = 0;
+		for (unsigned long r = 0; r < runs.size(); ++r)
+		{
+			Cursor cursor = {runs[r].data() + slices[r][threadNum], runs[r].data() + slices[r][threadNum + 1]};
+			if (cursor.curr != cursor.end)
+			{
+				mergedSize += cursor.end - cursor.curr;
+				heap.push_back(cursor);
+			}
+		}
+
+		// a single slice is reduced in place, more are merged first.
+		std::vector<IntermediatePair> merged;
+		IntermediatePair *begin = heap.size() == 1 ? heap.front().curr : nullptr;
+		IntermediatePair *end = heap.size() == 1 ? heap.front().end : nullptr;
+		if (heap.size() > 1)
+		{
+			merged.reserve(mergedSize);
+			std::make_heap(heap.begin(), heap.end(), compareCursors);
+			while (!heap.empty())
+			{
+				std::pop_heap(heap.begin(), heap.end(), compareCursors);
+				Cursor &top = heap.back();
+				merged.push_back(std::move(*top.curr));
+				if (++top.curr == top.end)
+				{
+					heap.pop_back();
+				}
+				else
+				{
+					std::push_heap(heap.begin(), heap.end(), compareCursors);
+				}
+			}
+			begin = merged.data();
+			end = merged.data() + merged.size();
+		}
+
+		Emitter<K3, V3> emitter(outputs[threadNum]);
+		while (begin != end)
+		{
+			IntermediatePair *groupEnd = std::upper_bound(begin, end, *begin, compareKeys);
+			client.reduce(begin, groupEnd, emitter);
+			unsigned long reduced = reducedCount.fetch_add((unsigned long) (groupEnd - begin)) + (groupEnd - begin);
+			// 100% is only reported once the output is spliced.
+			if (reduced < pairCount)
+			{
+				percentage.store(100 * (float) reduced / pairCount);
+			}
+			begin = groupEnd;
+		}
+	}
+
+	void planOutput()
+	{
+		unsigned long offset = output.size();
+		for (int i = 0; i < threadCount; ++i)
+		{
+			outputOffsets[i] = offset;
+			offset += outputs[i].size();
+		}
+		output.resize(offset);
+		// the runs are not needed anymore.
+		std::vector<std::vector<IntermediatePair> >().swap(runs);
+	}
+
+	void splicePhase(int threadNum)
+	{
+		std::move(outputs[threadNum].begin(), outputs[threadNum].end(), output.begin() + outputOffsets[threadNum]);
+		std::vector<OutputPair>().swap(outputs[threadNum]);
+	}
+};
+
+#endif //MAPREDUCEJOB_H
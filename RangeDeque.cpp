@@ -0,0 +1,65 @@
+#include "RangeDeque.h"
+#include <cstdlib>
+#include <cstdio>
+
+RangeDeque::RangeDeque()
+ : top(0)
+ , bottom(0)
+{ }
+
+
+void RangeDeque::push(unsigned long start, unsigned long end)
+{
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_acquire);
+	if (b - t >= CAPACITY) {
+		fprintf(stderr, "[[RangeDeque]] error on push to a full deque");
+		exit(1);
+	}
+	Slot &slot = slots[b % CAPACITY];
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+	// Publishes the range before the new bottom.
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+
+bool RangeDeque::pop(unsigned long *start, unsigned long *end)
+{
+	long b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	// Orders the claim of the bottom range before reading top, against thieves doing the opposite.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = top.load(std::memory_order_relaxed);
+	if (t > b) {
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+	Slot &slot = slots[b % CAPACITY];
+	*start = slot.start.load(std::memory_order_relaxed);
+	*end = slot.end.load(std::memory_order_relaxed);
+	if (t == b) {
+		// The last range, thieves may be racing for it.
+		bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+
+bool RangeDeque::steal(unsigned long *start, unsigned long *end, bool *empty)
+{
+	long t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = bottom.load(std::memory_order_acquire);
+	*empty = t >= b;
+	if (*empty) {
+		return false;
+	}
+	Slot &slot = slots[t % CAPACITY];
+	*start = slot.start.load(std::memory_order_relaxed);
+	*end = slot.end.load(std::memory_order_relaxed);
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
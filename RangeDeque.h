@@ -0,0 +1,35 @@
+#ifndef RANGEDEQUE_H
+#define RANGEDEQUE_H
+#include <atomic>
+
+// a chase-lev work-stealing deque of index ranges [start, end). its owner pushes
+// and pops at the bottom, any thread steals from the top, all without locks.
+// holds up to CAPACITY ranges, enough for an owner splitting its ranges in halves.
+
+class RangeDeque {
+public:
+	static const long CAPACITY = 128;
+
+	RangeDeque();
+	// owner only.
+	void push(unsigned long start, unsigned long end);
+	// owner only. returns false if the deque is empty.
+	bool pop(unsigned long *start, unsigned long *end);
+	// any thread. returns false if the deque is empty or another thread took the range first.
+	bool steal(unsigned long *start, unsigned long *end, bool *empty);
+
+private:
+	// keeps the owner's and the thieves' indices off each other's cache lines.
+	std::atomic<long> top;
+	char topPadding[64];
+	std::atomic<long> bottom;
+	char bottomPadding[64];
+	// ranges are read while the owner may reuse their slot, so each bound is atomic.
+	struct Slot {
+		std::atomic<unsigned long> start;
+		std::atomic<unsigned long> end;
+	};
+	Slot slots[CAPACITY];
+};
+
+#endif //RANGEDEQUE_H
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <string>
 #include <array>
+#include <type_traits>
 #include <unistd.h>
 
 class VString : public V1 {
@@ -19,6 +20,11 @@ public:
 	virtual bool operator<(const K3 &other) const {
 		return c < static_cast<const KChar&>(other).c;
 	}
+	virtual bool integerKey(std::uint64_t& key) const {
+		// flips the sign bit where char is signed, so negative chars keep their order.
+		key = (unsigned char) c ^ (std::is_signed<char>::value ? 0x80u : 0u);
+		return true;
+	}
 	char c;
 };
 
@@ -0,0 +1,166 @@
+/**
+ * This client is an AggregateClient that folds ints by their modulo MOD into their sum and their minimum.
+ * It runs the same input aggregated, where values are folded as they are emitted, and with
+ * SAMPLE_SORT_SHUFFLE, where the groups go through reduce, and checks that both give the expected results
+ * and that only the second one called reduce. A last HASH_SHUFFLE run has keys that implement hash but not
+ * equals, which can't be folded as emitted, and must go through reduce too.
+ */
+
+#include "MapReduceFramework.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#define MOD 1000
+#define INPUTS 100000
+#define THREADS 4
+
+// whether Kint implements equals.
+static bool keysHaveEquals = true;
+
+class Vint : public V1 {
+public:
+    explicit Vint(int content) : content(content) { }
+    int content;
+};
+
+class Kint : public K2, public K3 {
+public:
+    explicit Kint(int key) : key(key) { }
+    virtual bool operator<(const K2 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    virtual bool hash(std::size_t& result) const {
+        result = std::hash<int>()(key);
+        return true;
+    }
+    virtual bool equals(const K2 &other, bool& result) const {
+        result = key == static_cast<const Kint&>(other).key;
+        return keysHaveEquals;
+    }
+    int key;
+};
+
+class Vvalue : public V2 {
+public:
+    explicit Vvalue(int value) : value(value) { }
+    int value;
+};
+
+// the partial and final result of a key.
+class Vresult : public V3 {
+public:
+    Vresult() : sum(0), min(INT_MAX) { }
+    long sum;
+    int min;
+};
+
+class sumMinClient : public AggregateClient {
+public:
+    sumMinClient() : reduced(0) { }
+
+    void map(const K1* key, const V1* value, void* context) const {
+        int c = static_cast<const Vint*>(value)->content;
+        emit2(new Kint(c % MOD), new Vvalue(c), context);
+    }
+
+    virtual void* init(const K2* key) const {
+        return new Vresult();
+    }
+
+    virtual void accumulate(void* partial, const K2* key, V2* value) const {
+        Vresult *result = static_cast<Vresult*>(partial);
+        int c = static_cast<const Vvalue*>(value)->value;
+        result->sum += c;
+        result->min = std::min(result->min, c);
+        delete value;
+    }
+
+    virtual void merge(void* partial, void* other) const {
+        Vresult *result = static_cast<Vresult*>(partial);
+        Vresult *from = static_cast<Vresult*>(other);
+        result->sum += from->sum;
+        result->min = std::min(result->min, from->min);
+        delete from;
+    }
+
+    // the key is emitted as the output key.
+    virtual void finalize(K2* key, void* partial, void* context) const {
+        emit3(static_cast<Kint*>(key), static_cast<Vresult*>(partial), context);
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        reduced++;
+        AggregateClient::reduce(pairs, context);
+    }
+
+    mutable std::atomic<unsigned long> reduced;
+};
+
+typedef std::map<int, std::pair<long, int>> Results;
+
+// runs the job and collects its output, returns false if a key came out twice.
+bool runJob(const sumMinClient &client, const InputVec &inputVec, const JobOptions &options, Results *results)
+{
+    OutputVec outputVec;
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS, options);
+    closeJobHandle(job);
+    bool ok = true;
+    for (OutputPair& pair: outputVec) {
+        int key = static_cast<const Kint*>(pair.first)->key;
+        const Vresult *result = static_cast<const Vresult*>(pair.second);
+        ok = ok && results->count(key) == 0;
+        (*results)[key] = std::make_pair(result->sum, result->min);
+        delete pair.first;
+        delete pair.second;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<Vint> inputs;
+    Results expected;
+    for (int i = 0; i < INPUTS; i++) {
+        int c = (int) ((i * 7919L) % 100003);
+        inputs.emplace_back(c);
+        std::pair<long, int> &result = expected.emplace(c % MOD, std::make_pair(0L, INT_MAX)).first->second;
+        result.first += c;
+        result.second = std::min(result.second, c);
+    }
+    InputVec inputVec;
+    for (Vint &input: inputs) {
+        inputVec.emplace_back(InputPair({nullptr, &input}));
+    }
+
+    sumMinClient aggregating;
+    Results aggregated;
+    bool ok = runJob(aggregating, inputVec, JobOptions(), &aggregated) && aggregated == expected &&
+              aggregating.reduced == 0;
+    printf("aggregated: %s\n", ok ? "OK" : "FAILED");
+
+    sumMinClient reducing;
+    Results reduced;
+    JobOptions options;
+    options.shuffle = SAMPLE_SORT_SHUFFLE;
+    bool reducedOk = runJob(reducing, inputVec, options, &reduced) && reduced == expected &&
+                     reducing.reduced == expected.size();
+    printf("reduced: %s\n", reducedOk ? "OK" : "FAILED");
+
+    keysHaveEquals = false;
+    sumMinClient hashOnly;
+    Results hashOnlyResults;
+    options.shuffle = HASH_SHUFFLE;
+    bool hashOnlyOk = runJob(hashOnly, inputVec, options, &hashOnlyResults) && hashOnlyResults == expected &&
+                      hashOnly.reduced == expected.size();
+    printf("keys without equals, reduced: %s\n", hashOnlyOk ? "OK" : "FAILED");
+    return ok && reducedOk && hashOnlyOk ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+/**
+ * This client allocates its intermediate keys and values in the job arena with jobNew, and sums ints by
+ * their modulo MOD, once through reduce and once as a countOnly client whose keys are counted as they are
+ * emitted. It checks the sums, and that the arena objects are destroyed by closeJobHandle and not before.
+ * The countOnly client runs again with keys that implement hash but not equals, which can't be counted as
+ * emitted, so their groups must go through reduce.
+ */
+
+#include "MapReduceFramework.h"
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#define MOD 100
+#define INPUTS 20000
+#define THREADS 4
+
+static std::atomic<long> liveKeys(0);
+// whether Kint implements equals.
+static bool keysHaveEquals = true;
+
+class Vint : public V1 {
+public:
+    explicit Vint(int content) : content(content) { }
+    int content;
+};
+
+class Kint : public K2, public K3 {
+public:
+    explicit Kint(int key) : key(key) { liveKeys++; }
+    Kint(const Kint &other) : K2(), K3(), key(other.key) { liveKeys++; }
+    ~Kint() { liveKeys--; }
+    virtual bool operator<(const K2 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    virtual bool hash(std::size_t& result) const {
+        result = std::hash<int>()(key);
+        return true;
+    }
+    virtual bool equals(const K2 &other, bool& result) const {
+        result = key == static_cast<const Kint&>(other).key;
+        return keysHaveEquals;
+    }
+    int key;
+};
+
+class Vsum : public V2, public V3 {
+public:
+    explicit Vsum(long sum) : sum(sum) { }
+    long sum;
+};
+
+class arenaClient : public MapReduceClient {
+public:
+    explicit arenaClient(bool counting) : counting(counting), reduced(0) { }
+
+    // keys and values come from the arena, the output is allocated with new.
+    void map(const K1* key, const V1* value, void* context) const {
+        int c = static_cast<const Vint*>(value)->content;
+        emit2(jobNew<Kint>(context, c % MOD), counting ? nullptr : jobNew<Vsum>(context, c), context);
+    }
+
+    // arena objects are never deleted. pairs of the countOnly client have no values, each counts 1.
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        long sum = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            sum += counting ? 1 : static_cast<const Vsum*>(pair.second)->sum;
+        }
+        reduced++;
+        emit3(new Kint(*static_cast<const Kint*>(pairs->front().first)), new Vsum(sum), context);
+    }
+
+    virtual bool countOnly() const {
+        return counting;
+    }
+
+    virtual void reduceCount(K2* key, unsigned long count, void* context) const {
+        emit3(new Kint(*static_cast<const Kint*>(key)), new Vsum((long) count), context);
+    }
+
+    // keys come from the arena.
+    virtual void releaseKey(K2* key) const {
+    }
+
+    bool counting;
+    mutable std::atomic<unsigned long> reduced;
+};
+
+bool runJob(bool counting, const InputVec &inputVec)
+{
+    arenaClient client(counting);
+    OutputVec outputVec;
+    std::vector<long> expected(MOD, 0);
+    for (const InputPair &pair: inputVec) {
+        int c = static_cast<const Vint*>(pair.second)->content;
+        expected[c % MOD] += counting ? 1 : c;
+    }
+
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS);
+    waitForJob(job);
+    // the arena keys, plus one output key per group.
+    bool ok = liveKeys > (long) outputVec.size();
+    closeJobHandle(job);
+    ok = ok && liveKeys == (long) outputVec.size() && outputVec.size() == MOD;
+
+    for (OutputPair& pair: outputVec) {
+        int key = static_cast<const Kint*>(pair.first)->key;
+        ok = ok && static_cast<const Vsum*>(pair.second)->sum == expected[key];
+        expected[key] = -1;
+        delete pair.first;
+        delete pair.second;
+    }
+    // counted keys never reach reduce, unless they lack equals.
+    ok = ok && liveKeys == 0 && (client.reduced == 0) == (counting && keysHaveEquals);
+    printf("%s%s: %s\n", counting ? "counted" : "reduced", keysHaveEquals ? "" : ", keys without equals",
+           ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<Vint> inputs;
+    for (int i = 0; i < INPUTS; i++) {
+        inputs.emplace_back(i * 7 % 1000);
+    }
+    InputVec inputVec;
+    for (Vint &input: inputs) {
+        inputVec.emplace_back(InputPair({nullptr, &input}));
+    }
+
+    bool ok = runJob(false, inputVec);
+    ok = runJob(true, inputVec) && ok;
+    keysHaveEquals = false;
+    ok = runJob(true, inputVec) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/**
+ * This client is a DenseClient that sums ints by their modulo MOD with emitDense, so the job adds into flat
+ * arrays instead of sorting. Inputs are all even, so odd keys are never emitted. It checks the count and the
+ * sum of every emitted key, and that keys never emitted are left out of the output.
+ */
+
+#include "MapReduceFramework.h"
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#define MOD 1000
+#define INPUTS 200000
+#define THREADS 4
+
+class Vint : public V1 {
+public:
+    explicit Vint(int content) : content(content) { }
+    int content;
+};
+
+class Kint : public K3 {
+public:
+    explicit Kint(unsigned long key) : key(key) { }
+    virtual bool operator<(const K3 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    unsigned long key;
+};
+
+class Vresult : public V3 {
+public:
+    Vresult(std::uint64_t count, std::uint64_t sum) : count(count), sum(sum) { }
+    std::uint64_t count;
+    std::uint64_t sum;
+};
+
+class modsumClient : public DenseClient {
+public:
+    void map(const K1* key, const V1* value, void* context) const {
+        int c = static_cast<const Vint*>(value)->content;
+        emitDense((unsigned long) (c % MOD), (std::uint64_t) c, context);
+    }
+
+    virtual unsigned long domainSize() const {
+        return MOD;
+    }
+
+    virtual void reduceDense(unsigned long key, std::uint64_t count, std::uint64_t sum, void* context) const {
+        emit3(new Kint(key), new Vresult(count, sum), context);
+    }
+};
+
+int main(int argc, char** argv)
+{
+    std::vector<Vint> inputs;
+    std::vector<std::uint64_t> counts(MOD, 0);
+    std::vector<std::uint64_t> sums(MOD, 0);
+    std::uint32_t seed = 4242;
+    for (int i = 0; i < INPUTS; i++) {
+        seed = seed * 1103515245 + 12345;
+        int c = (int) ((seed >> 8) % (5 * MOD)) * 2;
+        inputs.emplace_back(c);
+        counts[c % MOD]++;
+        sums[c % MOD] += c;
+    }
+    InputVec inputVec;
+    for (Vint &input: inputs) {
+        inputVec.emplace_back(InputPair({nullptr, &input}));
+    }
+
+    modsumClient client;
+    OutputVec outputVec;
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS);
+    closeJobHandle(job);
+
+    bool ok = outputVec.size() == MOD / 2;
+    for (OutputPair& pair: outputVec) {
+        unsigned long key = static_cast<const Kint*>(pair.first)->key;
+        const Vresult *result = static_cast<const Vresult*>(pair.second);
+        ok = ok && key % 2 == 0 && result->count == counts[key] && result->sum == sums[key];
+        // each key comes out once.
+        counts[key] = 0;
+        delete pair.first;
+        delete pair.second;
+    }
+    printf("dense sums by modulo: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
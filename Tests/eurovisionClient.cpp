@@ -4,6 +4,8 @@
  *
  * This client reads the file points_awarded.h - Eurovision data from 1975-2016.
  * It then finds the winner from each year, and counts how many wins each country had.
+ * The wins are counted as they are emitted, with countOnly and reduceCount, then counted again with
+ * SAMPLE_SORT_SHUFFLE, which goes through reduce, and both counts must agree.
  *
  */
 
@@ -13,6 +15,8 @@
 #include <array>
 #include <fstream>
 #include <vector>
+#include <functional>
+#include <map>
 #include "../MapReduceFramework.h"
 
 typedef std::pair<std::string, int> Points_received_by_country;
@@ -53,6 +57,15 @@ public:
     virtual bool operator<(const K3 &other) const {
         return country < static_cast<const Kwinner&>(other).country;
     }
+    // wins are counted per country in any order, so countries are grouped by hash.
+    virtual bool hash(std::size_t& result) const {
+        result = std::hash<std::string>()(country);
+        return true;
+    }
+    virtual bool equals(const K2 &other, bool& result) const {
+        result = country == static_cast<const Kwinner&>(other).country;
+        return true;
+    }
 };
 
 
@@ -66,7 +79,7 @@ public:
 
 
 
-class eurovisionClient : public SampleClient {
+class eurovisionClient : public MapReduceClient {
 public:
     /**
      * Finds the winning country for each year by choosing the country that received the most
@@ -105,6 +118,15 @@ public:
         emit3(k3, v3, context);
     }
 
+    // winners are emitted without values, so each country is kept once with its number of wins.
+    virtual bool countOnly() const {
+        return true;
+    }
+
+    virtual void reduceCount(K2 *key, unsigned long count, void *context) const {
+        emit3(static_cast<Kwinner *>(key), new Vwins(static_cast<int>(count)), context);
+    }
+
     virtual void printt(IntermediateVec & v) const {
 
         for (IntermediatePair& pair: v) {
@@ -155,8 +177,9 @@ int main(int argc, char **argv) {
     InputVec inputVec;
     OutputVec outputVec;
 
-    // TODO - enter your path to "new_clients/points_awarded.in"
-    process_data("/cs/usr/alonemanuel/Year2/Semester2/67808_OS/EX3_67808_OS_HUJI/Tests/points_awarded.in", &inputVec);
+    // TODO - enter your path to "new_clients/points_awarded.in", or pass it as the first argument
+    process_data(argc > 1 ? argv[1] :
+                 "/cs/usr/alonemanuel/Year2/Semester2/67808_OS/EX3_67808_OS_HUJI/Tests/points_awarded.in", &inputVec);
 
 JobHandle handle;
     handle =startMapReduceJob(client, inputVec, outputVec, 40);
@@ -166,14 +189,32 @@ JobHandle handle;
 	std::cout << LOG_PREFIX << "Size of input is: " << inputVec.size()<<std::endl;
 	std::cout << LOG_PREFIX << "Size of output is: " << outputVec.size()<<std::endl;
     printf("Total Eurovision wins 1975-2016:\n");
+    std::map<std::string, int> counted;
     for (OutputPair& pair: outputVec) {
         std::string country = ((const Kwinner*)pair.first)->country;
         int wins = ((const Vwins*)pair.second)->wins;
         printf("%s: %d win%s\n",
                country.c_str(), wins, wins > 1 ? "s" : "");
+        counted[country] = wins;
+        delete pair.first;
+        delete pair.second;
+    }
+    closeJobHandle(handle);
+
+    // sorted output needs the pairs, so the same wins are counted by reduce.
+    JobOptions options;
+    options.shuffle = SAMPLE_SORT_SHUFFLE;
+    OutputVec reducedVec;
+    handle = startMapReduceJob(client, inputVec, reducedVec, 40, options);
+    closeJobHandle(handle);
+    std::map<std::string, int> reduced;
+    for (OutputPair& pair: reducedVec) {
+        reduced[((const Kwinner*)pair.first)->country] = ((const Vwins*)pair.second)->wins;
         delete pair.first;
         delete pair.second;
     }
+    bool ok = !counted.empty() && counted.size() == outputVec.size() && counted == reduced;
+    printf("counted wins match reduced wins: %s\n", ok ? "OK" : "FAILED");
 
 
     for (auto i : inputVec) {
@@ -181,6 +222,6 @@ JobHandle handle;
         delete i.second;
     }
 
-    return 0;
+    return ok ? 0 : 1;
 }
 
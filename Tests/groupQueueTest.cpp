@@ -0,0 +1,101 @@
+/**
+ * This test runs the GroupQueue between shuffling and reducing threads on its own. Consumers block on an
+ * empty queue before any producer starts, then several producers push many groups through a queue small
+ * enough to fill up, and every group must be popped exactly once. It also checks that consumers blocked on
+ * an empty queue all wake up and return once the last producer leaves.
+ */
+
+#include "GroupQueue.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define GROUPS 100000
+#define CAPACITY 16
+// long enough for the consumers to block in pop before anything is pushed.
+#define BLOCK_MS 50
+
+// a group per pair, told apart by where it points to.
+static IntermediatePair pairs[GROUPS];
+
+// producers push their share of the groups while consumers pop them.
+bool produceAndConsume()
+{
+    // holds the consumers in pop until the producers joined.
+    GroupQueue queue(CAPACITY, 1);
+    std::vector<std::atomic<int>> popped(GROUPS);
+    for (std::atomic<int> &count: popped) {
+        count = 0;
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < CONSUMERS; i++) {
+        threads.emplace_back([&]() {
+            QueuedGroup group;
+            while (queue.pop(&group)) {
+                popped[group.begin - pairs]++;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(BLOCK_MS));
+    for (int i = 0; i < PRODUCERS; i++) {
+        queue.addProducer();
+        threads.emplace_back([&queue, i]() {
+            for (int j = i; j < GROUPS; j += PRODUCERS) {
+                QueuedGroup group = {pairs + j, pairs + j + 1, nullptr};
+                while (!queue.push(group)) {
+                    std::this_thread::yield();
+                }
+            }
+            queue.removeProducer();
+        });
+    }
+    queue.removeProducer();
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    QueuedGroup group;
+    bool ok = !queue.tryPop(&group);
+    for (std::atomic<int> &count: popped) {
+        ok = ok && count == 1;
+    }
+    printf("%d producers, %d consumers, %d groups: %s\n", PRODUCERS, CONSUMERS, GROUPS, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// consumers block on a queue nothing is pushed to, until its only producer leaves.
+bool lastProducerWakeup()
+{
+    GroupQueue queue(CAPACITY, 1);
+    std::atomic<int> returned(0);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < CONSUMERS; i++) {
+        consumers.emplace_back([&]() {
+            QueuedGroup group;
+            while (queue.pop(&group)) {
+                popped++;
+            }
+            returned++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(BLOCK_MS));
+    bool ok = returned == 0;
+    queue.removeProducer();
+    for (std::thread &consumer: consumers) {
+        consumer.join();
+    }
+    ok = ok && returned == CONSUMERS && popped == 0;
+    printf("last producer wakes %d blocked consumers: %s\n", CONSUMERS, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool ok = produceAndConsume();
+    ok = lastProducerWakeup() && ok;
+    return ok ? 0 : 1;
+}
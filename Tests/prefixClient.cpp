@@ -0,0 +1,132 @@
+/**
+ * This client counts words whose keys implement K2::normalizedPrefix, their first 8 bytes, so runs are
+ * sorted and merged by prefix first and by operator< only on equal prefixes. Most words share a prefix and
+ * differ in their tails, some are shorter than a prefix. It runs SORT_SHUFFLE and SAMPLE_SORT_SHUFFLE with
+ * several threads, checks the counts and that the sample sort output is ordered by word.
+ */
+
+#include "MapReduceFramework.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define WORDS 60000
+#define TAILS 300
+#define THREADS 6
+
+static std::atomic<unsigned long> prefixCalls(0);
+
+class VWord : public V1 {
+public:
+    explicit VWord(const std::string &word) : word(word) { }
+    std::string word;
+};
+
+class KWord : public K2, public K3 {
+public:
+    explicit KWord(const std::string &word) : word(word) { }
+    virtual bool operator<(const K2 &other) const {
+        return word < static_cast<const KWord&>(other).word;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return word < static_cast<const KWord&>(other).word;
+    }
+    // the first 8 bytes, big endian and padded with zeros, so prefixes order like the words.
+    virtual bool normalizedPrefix(std::uint64_t& prefix) const {
+        prefix = 0;
+        for (std::size_t i = 0; i < 8; i++) {
+            prefix = prefix << 8 | (i < word.size() ? (unsigned char) word[i] : 0);
+        }
+        prefixCalls++;
+        return true;
+    }
+    std::string word;
+};
+
+class VCount : public V2, public V3 {
+public:
+    explicit VCount(unsigned long count) : count(count) { }
+    unsigned long count;
+};
+
+class prefixClient : public MapReduceClient {
+public:
+    void map(const K1* key, const V1* value, void* context) const {
+        emit2(new KWord(static_cast<const VWord*>(value)->word), new VCount(1), context);
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        unsigned long count = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            count += static_cast<const VCount*>(pair.second)->count;
+        }
+        emit3(new KWord(static_cast<const KWord*>(pairs->front().first)->word), new VCount(count), context);
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+    }
+};
+
+typedef std::map<std::string, unsigned long> Counts;
+
+bool runJob(const InputVec &inputVec, const Counts &expected, shuffle_t shuffle, const char *name)
+{
+    prefixClient client;
+    OutputVec outputVec;
+    JobOptions options;
+    options.shuffle = shuffle;
+    prefixCalls = 0;
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS, options);
+    closeJobHandle(job);
+    Counts counts;
+    bool ok = prefixCalls > 0;
+    for (unsigned long i = 0; i < outputVec.size(); i++) {
+        const std::string &word = static_cast<const KWord*>(outputVec[i].first)->word;
+        ok = ok && counts.count(word) == 0;
+        if (shuffle == SAMPLE_SORT_SHUFFLE && i > 0) {
+            ok = ok && *outputVec[i - 1].first < *outputVec[i].first;
+        }
+        counts[word] = static_cast<const VCount*>(outputVec[i].second)->count;
+    }
+    for (OutputPair& pair: outputVec) {
+        delete pair.first;
+        delete pair.second;
+    }
+    ok = ok && counts == expected;
+    printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<VWord> words;
+    Counts expected;
+    std::uint32_t seed = 99;
+    for (int i = 0; i < WORDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned long r = (seed >> 8) % TAILS;
+        std::string word;
+        if (r % 10 == 0) {
+            // shorter than a prefix, ordered before the shared prefix's longer words.
+            word = std::string("sharedp").substr(0, r % 7 + 1);
+        } else if (r % 10 == 1) {
+            word = "other" + std::to_string(r);
+        } else {
+            word = "sharedprefix/" + std::to_string(r % 7) + "/" + std::to_string(r);
+        }
+        words.emplace_back(word);
+        expected[word]++;
+    }
+    InputVec inputVec;
+    for (VWord &word: words) {
+        inputVec.emplace_back(InputPair({nullptr, &word}));
+    }
+
+    bool ok = runJob(inputVec, expected, SORT_SHUFFLE, "sort shuffle by normalized prefix");
+    ok = runJob(inputVec, expected, SAMPLE_SORT_SHUFFLE, "sample sort shuffle by normalized prefix") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * This client counts keys that are radix sorted: signed integers that implement K2::integerKey by flipping
+ * their sign bit, and strings that implement K2::keyBytes. Integer keys are small numbers of either sign,
+ * full 64 bit values and the extremes. Byte keys include the empty string, long shared prefixes and bytes
+ * of 0x80 and above. Each runs SORT_SHUFFLE and SAMPLE_SORT_SHUFFLE with several threads, so runs are split
+ * in several splitter ranges, and checks the counts and that the sample sort output is ordered by key.
+ */
+
+#include "MapReduceFramework.h"
+#include <cstdio>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#define KEYS 100000
+#define THREADS 5
+
+template<class Value>
+class VInput : public V1 {
+public:
+    explicit VInput(const Value &value) : value(value) { }
+    Value value;
+};
+
+class KNumber : public K2, public K3 {
+public:
+    typedef std::int64_t Value;
+    explicit KNumber(Value value) : value(value) { }
+    virtual bool operator<(const K2 &other) const {
+        return value < static_cast<const KNumber&>(other).value;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return value < static_cast<const KNumber&>(other).value;
+    }
+    // flipping the sign bit orders negative numbers before positive ones.
+    virtual bool integerKey(std::uint64_t& key) const {
+        key = (std::uint64_t) value ^ (std::uint64_t(1) << 63);
+        return true;
+    }
+    Value value;
+};
+
+// std::string compares its chars like memcmp, as unsigned chars.
+class KBytes : public K2, public K3 {
+public:
+    typedef std::string Value;
+    explicit KBytes(const Value &value) : value(value) { }
+    virtual bool operator<(const K2 &other) const {
+        return value < static_cast<const KBytes&>(other).value;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return value < static_cast<const KBytes&>(other).value;
+    }
+    virtual bool keyBytes(const char*& bytes, std::size_t& size) const {
+        bytes = value.data();
+        size = value.size();
+        return true;
+    }
+    Value value;
+};
+
+class VCount : public V2, public V3 {
+public:
+    explicit VCount(unsigned long count) : count(count) { }
+    unsigned long count;
+};
+
+template<class Key>
+class countClient : public MapReduceClient {
+public:
+    void map(const K1* key, const V1* value, void* context) const {
+        emit2(new Key(static_cast<const VInput<typename Key::Value>*>(value)->value), new VCount(1), context);
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        unsigned long count = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            count += static_cast<const VCount*>(pair.second)->count;
+        }
+        emit3(new Key(static_cast<const Key*>(pairs->front().first)->value), new VCount(count), context);
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+    }
+};
+
+template<class Key>
+bool runJob(const InputVec &inputVec, const std::map<typename Key::Value, unsigned long> &expected,
+            shuffle_t shuffle, const char *name)
+{
+    countClient<Key> client;
+    OutputVec outputVec;
+    JobOptions options;
+    options.shuffle = shuffle;
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS, options);
+    closeJobHandle(job);
+    std::map<typename Key::Value, unsigned long> counts;
+    bool ok = true;
+    for (unsigned long i = 0; i < outputVec.size(); i++) {
+        const typename Key::Value &value = static_cast<const Key*>(outputVec[i].first)->value;
+        ok = ok && counts.count(value) == 0;
+        if (shuffle == SAMPLE_SORT_SHUFFLE && i > 0) {
+            ok = ok && *outputVec[i - 1].first < *outputVec[i].first;
+        }
+        counts[value] = static_cast<const VCount*>(outputVec[i].second)->count;
+    }
+    for (OutputPair& pair: outputVec) {
+        delete pair.first;
+        delete pair.second;
+    }
+    ok = ok && counts == expected;
+    printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// runs the job on values, returns whether both shuffles gave the right counts.
+template<class Key>
+bool runShuffles(const std::vector<VInput<typename Key::Value>> &values, const char *sortName,
+                 const char *sampleSortName)
+{
+    std::map<typename Key::Value, unsigned long> expected;
+    InputVec inputVec;
+    for (const VInput<typename Key::Value> &value: values) {
+        expected[value.value]++;
+        inputVec.emplace_back(InputPair({nullptr, const_cast<VInput<typename Key::Value>*>(&value)}));
+    }
+    bool ok = runJob<Key>(inputVec, expected, SORT_SHUFFLE, sortName);
+    return runJob<Key>(inputVec, expected, SAMPLE_SORT_SHUFFLE, sampleSortName) && ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<VInput<KNumber::Value>> numbers;
+    std::vector<VInput<KBytes::Value>> strings;
+    std::uint64_t seed = 2024;
+    for (int i = 0; i < KEYS; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::int64_t number;
+        std::string bytes;
+        switch (i % 4) {
+            case 0:
+                // small, of either sign, often repeated.
+                number = (std::int64_t) (seed >> 33) % 1000 - 500;
+                // empty, or a few bytes of any value.
+                bytes = std::string((seed >> 20) % 3, (char) (seed >> 40));
+                break;
+            case 1:
+                number = (std::int64_t) seed;
+                // a long prefix shared by many keys, then a varying tail.
+                bytes = std::string(40, 'p') + std::to_string((seed >> 40) % 500);
+                break;
+            case 2:
+                // negative, differing only in their low bytes.
+                number = -(std::int64_t) (seed >> 48) - 1;
+                // bytes of 0x80 and above, ordered after ASCII.
+                bytes = std::string(1, (char) (0x80 + (seed >> 58))) + std::string(12, '\xff') +
+                        std::string(1, (char) (seed >> 32));
+                break;
+            default:
+                number = i % 8 == 3 ? std::numeric_limits<std::int64_t>::min() :
+                         std::numeric_limits<std::int64_t>::max();
+                // proper prefixes of each other, and of the shared prefix above.
+                bytes = std::string((seed >> 40) % 45, 'p');
+        }
+        numbers.emplace_back(number);
+        strings.emplace_back(bytes);
+    }
+
+    bool ok = runShuffles<KNumber>(numbers, "sort shuffle of integer keys", "sample sort shuffle of integer keys");
+    ok = runShuffles<KBytes>(strings, "sort shuffle of byte keys", "sample sort shuffle of byte keys") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/**
+ * This test runs the work-stealing RangeDeque on its own. It fills a deque to CAPACITY and drains it, checks
+ * that pushing past CAPACITY exits with an error, then has the owner push and pop many ranges while thieves
+ * steal from it, and checks that every range was taken exactly once, by the owner or by a thief.
+ */
+
+#include "RangeDeque.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#define THIEVES 3
+#define RANGES 200000
+// ranges the owner pushes before popping what the thieves left.
+#define BATCH 64
+
+// pushes CAPACITY ranges twice around the slots, and pops them back in reverse order.
+bool fillAndDrain()
+{
+    RangeDeque deque;
+    unsigned long start, end;
+    bool ok = true;
+    for (int round = 0; round < 2; round++) {
+        for (long i = 0; i < RangeDeque::CAPACITY; i++) {
+            deque.push(i, i + 1);
+        }
+        for (long i = RangeDeque::CAPACITY - 1; i >= 0; i--) {
+            ok = ok && deque.pop(&start, &end) && start == (unsigned long) i && end == start + 1;
+        }
+        ok = ok && !deque.pop(&start, &end);
+        // moves top past the slots, so the next round wraps around.
+        for (long i = 0; i < RangeDeque::CAPACITY / 2; i++) {
+            bool empty;
+            deque.push(i, i + 1);
+            ok = ok && deque.steal(&start, &end, &empty) && start == (unsigned long) i;
+        }
+    }
+    printf("fill to capacity and drain: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// pushes one range more than CAPACITY in a child process, which must exit with 1.
+bool overflow()
+{
+    // the child exits through exit, which would print what is still buffered again.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stderr);
+        RangeDeque deque;
+        for (long i = 0; i <= RangeDeque::CAPACITY; i++) {
+            deque.push(i, i + 1);
+        }
+        _exit(0);
+    }
+    int status;
+    bool ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 1;
+    printf("push to a full deque exits: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// the owner pushes batches of single item ranges and pops them while thieves steal.
+bool popAndSteal()
+{
+    RangeDeque deque;
+    std::vector<std::atomic<int>> taken(RANGES);
+    for (std::atomic<int> &count: taken) {
+        count = 0;
+    }
+    std::atomic<bool> done(false);
+    std::atomic<unsigned long> stolen(0);
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < THIEVES; i++) {
+        thieves.emplace_back([&]() {
+            unsigned long start, end;
+            bool empty = false;
+            while (!done || !empty) {
+                if (deque.steal(&start, &end, &empty)) {
+                    taken[start]++;
+                    stolen++;
+                } else if (empty) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    unsigned long start, end;
+    for (unsigned long next = 0; next < RANGES;) {
+        for (int i = 0; i < BATCH && next < RANGES; i++, next++) {
+            deque.push(next, next + 1);
+        }
+        // a failed pop leaves the deque empty, whether or not a thief won the last range.
+        while (deque.pop(&start, &end)) {
+            taken[start]++;
+        }
+    }
+    done = true;
+    for (std::thread &thief: thieves) {
+        thief.join();
+    }
+    bool ok = true;
+    for (std::atomic<int> &count: taken) {
+        ok = ok && count == 1;
+    }
+    printf("pop against %d thieves, %lu of %d ranges stolen: %s\n", THIEVES, stolen.load(), RANGES,
+           ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool ok = fillAndDrain();
+    ok = overflow() && ok;
+    ok = popAndSteal() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+/**
+ * This client counts the words of generated lines, with values, so every pair is kept until it is reduced.
+ * It runs the same job in memory and with a memory budget small enough that every thread spills many sorted
+ * runs, and checks that both give the right counts and that the spilled runs took more than one merge pass.
+ * Both runs are repeated with SAMPLE_SORT_SHUFFLE, whose output must come out sorted by word. A last client
+ * counts the words' numbers as integer keys with a combiner that emits two pairs per group, under a budget
+ * small enough that the combine at the end of map would go over it, and checks the counts.
+ */
+
+#include "MapReduceFramework.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#define LINES 3000
+#define WORDS_PER_LINE 8
+#define VOCABULARY 500
+#define THREADS 4
+// Runs of about this many pairs are spilled, so a thread spills far more runs than one merge takes.
+#define PAIRS_PER_RUN 40
+// Pairs a thread of the combining client keeps before spilling.
+#define COMBINED_PAIRS_PER_RUN 200
+
+class VLine : public V1 {
+public:
+    explicit VLine(const std::string &line) : line(line) { }
+    std::string line;
+};
+
+class KWord : public K2, public K3 {
+public:
+    explicit KWord(const std::string &word) : word(word) { }
+    virtual bool operator<(const K2 &other) const {
+        return word < static_cast<const KWord&>(other).word;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return word < static_cast<const KWord&>(other).word;
+    }
+    std::string word;
+};
+
+class VCount : public V2, public V3 {
+public:
+    explicit VCount(unsigned long count) : count(count) { }
+    unsigned long count;
+};
+
+class countClient : public MapReduceClient {
+public:
+    countClient() : emitted(0), spilled(0), unspilled(0) { }
+
+    void map(const K1* key, const V1* value, void* context) const {
+        std::istringstream words(static_cast<const VLine*>(value)->line);
+        std::string word;
+        while (words >> word) {
+            emit2(new KWord(word), new VCount(1), context);
+            emitted++;
+        }
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        unsigned long count = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            count += static_cast<const VCount*>(pair.second)->count;
+        }
+        emit3(new KWord(static_cast<const KWord*>(pairs->front().first)->word), new VCount(count), context);
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+    }
+
+    // writes the word's length, its bytes and the count.
+    virtual bool spill(const IntermediatePair& pair, std::FILE* file) const {
+        const std::string &word = static_cast<const KWord*>(pair.first)->word;
+        std::uint32_t size = (std::uint32_t) word.size();
+        unsigned long count = static_cast<const VCount*>(pair.second)->count;
+        if (fwrite(&size, sizeof(size), 1, file) != 1 || fwrite(word.data(), 1, size, file) != size ||
+            fwrite(&count, sizeof(count), 1, file) != 1) {
+            fprintf(stderr, "spillClient: error on fwrite\n");
+            exit(1);
+        }
+        delete pair.first;
+        delete pair.second;
+        spilled++;
+        return true;
+    }
+
+    virtual IntermediatePair unspill(std::FILE* file) const {
+        std::uint32_t size;
+        unsigned long count;
+        std::string word;
+        if (fread(&size, sizeof(size), 1, file) != 1) {
+            fprintf(stderr, "spillClient: error on fread\n");
+            exit(1);
+        }
+        word.resize(size);
+        if (fread(&word[0], 1, size, file) != size || fread(&count, sizeof(count), 1, file) != 1) {
+            fprintf(stderr, "spillClient: error on fread\n");
+            exit(1);
+        }
+        unspilled++;
+        return IntermediatePair(new KWord(word), new VCount(count));
+    }
+
+    mutable std::atomic<unsigned long> emitted;
+    mutable std::atomic<unsigned long> spilled;
+    mutable std::atomic<unsigned long> unspilled;
+};
+
+class KNumber : public K2, public K3 {
+public:
+    explicit KNumber(std::uint64_t number) : number(number) { }
+    virtual bool operator<(const K2 &other) const {
+        return number < static_cast<const KNumber&>(other).number;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return number < static_cast<const KNumber&>(other).number;
+    }
+    virtual bool integerKey(std::uint64_t& key) const {
+        key = number;
+        return true;
+    }
+    std::uint64_t number;
+};
+
+// counts the number after each word's 'w', combining counts in two halves, so combining a group emits two
+// pairs, more than it got for groups of one.
+class combiningClient : public MapReduceClient {
+public:
+    void map(const K1* key, const V1* value, void* context) const {
+        std::istringstream words(static_cast<const VLine*>(value)->line);
+        std::string word;
+        while (words >> word) {
+            emit2(new KNumber(std::stoul(word.substr(1))), new VCount(1), context);
+        }
+    }
+
+    virtual bool combine(const IntermediateVec* pairs, void* context) const {
+        unsigned long count = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            count += static_cast<const VCount*>(pair.second)->count;
+        }
+        std::uint64_t number = static_cast<const KNumber*>(pairs->front().first)->number;
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+        emit2(new KNumber(number), new VCount(count / 2), context);
+        emit2(new KNumber(number), new VCount(count - count / 2), context);
+        return true;
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        unsigned long count = 0;
+        for (const IntermediatePair& pair: *pairs) {
+            count += static_cast<const VCount*>(pair.second)->count;
+        }
+        emit3(new KNumber(static_cast<const KNumber*>(pairs->front().first)->number), new VCount(count), context);
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+    }
+
+    // writes the number and the count.
+    virtual bool spill(const IntermediatePair& pair, std::FILE* file) const {
+        std::uint64_t number = static_cast<const KNumber*>(pair.first)->number;
+        unsigned long count = static_cast<const VCount*>(pair.second)->count;
+        if (fwrite(&number, sizeof(number), 1, file) != 1 || fwrite(&count, sizeof(count), 1, file) != 1) {
+            fprintf(stderr, "spillClient: error on fwrite\n");
+            exit(1);
+        }
+        delete pair.first;
+        delete pair.second;
+        return true;
+    }
+
+    virtual IntermediatePair unspill(std::FILE* file) const {
+        std::uint64_t number;
+        unsigned long count;
+        if (fread(&number, sizeof(number), 1, file) != 1 || fread(&count, sizeof(count), 1, file) != 1) {
+            fprintf(stderr, "spillClient: error on fread\n");
+            exit(1);
+        }
+        return IntermediatePair(new KNumber(number), new VCount(count));
+    }
+};
+
+typedef std::map<std::string, unsigned long> Counts;
+
+// runs the job and collects its output, returns false if a word came out twice, or out of order in
+// SAMPLE_SORT_SHUFFLE jobs.
+bool runJob(const countClient &client, const InputVec &inputVec, const JobOptions &options, Counts *counts)
+{
+    OutputVec outputVec;
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS, options);
+    closeJobHandle(job);
+    bool ok = true;
+    for (unsigned long i = 0; i < outputVec.size(); i++) {
+        const std::string &word = static_cast<const KWord*>(outputVec[i].first)->word;
+        ok = ok && counts->count(word) == 0;
+        if (options.shuffle == SAMPLE_SORT_SHUFFLE && i > 0) {
+            ok = ok && *outputVec[i - 1].first < *outputVec[i].first;
+        }
+        (*counts)[word] = static_cast<const VCount*>(outputVec[i].second)->count;
+    }
+    for (OutputPair& pair: outputVec) {
+        delete pair.first;
+        delete pair.second;
+    }
+    return ok;
+}
+
+// runs the job in memory and spilled, returns the number of failed runs.
+int runShuffle(const InputVec &inputVec, const Counts &expected, shuffle_t shuffle, const char *name)
+{
+    int failed = 0;
+    countClient inMemory;
+    Counts inMemoryCounts;
+    JobOptions options;
+    options.shuffle = shuffle;
+    bool ok = runJob(inMemory, inputVec, options, &inMemoryCounts) && inMemoryCounts == expected &&
+              inMemory.spilled == 0;
+    printf("%s in memory: %s\n", name, ok ? "OK" : "FAILED");
+    failed += !ok;
+
+    countClient spilling;
+    Counts spilledCounts;
+    options.memoryBudget = THREADS * PAIRS_PER_RUN * sizeof(IntermediatePair);
+    ok = runJob(spilling, inputVec, options, &spilledCounts) && spilledCounts == expected;
+    // every pair is spilled once by map, and again by each merge pass before the final merge.
+    unsigned long passes = spilling.spilled / spilling.emitted;
+    ok = ok && spilling.spilled % spilling.emitted == 0 && passes >= 2 && spilling.unspilled == spilling.spilled;
+    printf("%s spilled, %lu merge passes before the final one: %s\n", name, passes - 1, ok ? "OK" : "FAILED");
+    failed += !ok;
+    return failed;
+}
+
+// runs the combining client spilled, returns the number of failed runs.
+int runCombining(const InputVec &inputVec, const Counts &expected, shuffle_t shuffle, const char *name)
+{
+    combiningClient client;
+    OutputVec outputVec;
+    JobOptions options;
+    options.shuffle = shuffle;
+    options.memoryBudget = THREADS * COMBINED_PAIRS_PER_RUN * sizeof(IntermediatePair);
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS, options);
+    closeJobHandle(job);
+    Counts counts;
+    bool ok = true;
+    for (OutputPair& pair: outputVec) {
+        std::string word = "w" + std::to_string(static_cast<const KNumber*>(pair.first)->number);
+        ok = ok && counts.count(word) == 0;
+        counts[word] = static_cast<const VCount*>(pair.second)->count;
+        delete pair.first;
+        delete pair.second;
+    }
+    ok = ok && counts == expected;
+    printf("%s combined and spilled: %s\n", name, ok ? "OK" : "FAILED");
+    return !ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<VLine> lines;
+    Counts expected;
+    std::uint32_t seed = 12345;
+    for (int i = 0; i < LINES; i++) {
+        std::string line;
+        for (int j = 0; j < WORDS_PER_LINE; j++) {
+            seed = seed * 1103515245 + 12345;
+            std::string word = "w" + std::to_string((seed >> 8) % VOCABULARY);
+            expected[word]++;
+            line += word + " ";
+        }
+        lines.emplace_back(line);
+    }
+    InputVec inputVec;
+    for (VLine &line: lines) {
+        inputVec.emplace_back(InputPair({nullptr, &line}));
+    }
+
+    int failed = runShuffle(inputVec, expected, SORT_SHUFFLE, "sort shuffle");
+    failed += runShuffle(inputVec, expected, SAMPLE_SORT_SHUFFLE, "sample sort shuffle");
+    failed += runCombining(inputVec, expected, SORT_SHUFFLE, "sort shuffle");
+    failed += runCombining(inputVec, expected, SAMPLE_SORT_SHUFFLE, "sample sort shuffle");
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/**
+ * This client counts the words of generated lines with the typed MapReduceJob template: words are kept as
+ * std::string by value, and the client is called without virtual calls. It checks the counts, and that the
+ * output comes out sorted by word across all threads.
+ */
+
+#include "MapReduceJob.h"
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#define LINES 5000
+#define WORDS_PER_LINE 6
+#define VOCABULARY 2000
+#define THREADS 6
+
+class wordCountClient {
+public:
+    void map(const int &key, const std::string &value, Emitter<std::string, int> &emitter) const {
+        std::istringstream words(value);
+        std::string word;
+        while (words >> word) {
+            emitter.emit(word, 1);
+        }
+    }
+
+    void reduce(const std::pair<std::string, int> *begin, const std::pair<std::string, int> *end,
+                Emitter<std::string, int> &emitter) const {
+        int count = 0;
+        for (const std::pair<std::string, int> *pair = begin; pair != end; ++pair) {
+            count += pair->second;
+        }
+        emitter.emit(begin->first, count);
+    }
+};
+
+typedef MapReduceJob<int, std::string, std::string, int, std::string, int, wordCountClient> WordCountJob;
+
+int main(int argc, char** argv)
+{
+    std::vector<WordCountJob::InputPair> input;
+    std::map<std::string, int> expected;
+    std::uint32_t seed = 777;
+    for (int i = 0; i < LINES; i++) {
+        std::string line;
+        for (int j = 0; j < WORDS_PER_LINE; j++) {
+            seed = seed * 1103515245 + 12345;
+            std::string word = "w" + std::to_string((seed >> 8) % VOCABULARY);
+            expected[word]++;
+            line += word + " ";
+        }
+        input.emplace_back(i, line);
+    }
+
+    wordCountClient client;
+    std::vector<WordCountJob::OutputPair> output;
+    JobOptions options;
+    options.weight = 2;
+    JobHandle job = WordCountJob::start(client, input, output, THREADS, options);
+    waitForJob(job);
+    JobState state;
+    getJobState(job, &state);
+    closeJobHandle(job);
+
+    bool ok = state.stage == REDUCE_STAGE && state.percentage == 100 && output.size() == expected.size();
+    for (unsigned long i = 0; i < output.size() && ok; i++) {
+        ok = (i == 0 || output[i - 1].first < output[i].first) && expected[output[i].first] == output[i].second;
+    }
+    printf("typed word count, sorted by word: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/**
+ * This client's map waits for the test to open a gate, so the test controls when its job ends. It checks
+ * that waitForJobFor times out on a running job and returns once it's done, and that the job's event fd is
+ * readable only once the job ends, including a fd asked for after the job is already done.
+ */
+
+#include "MapReduceFramework.h"
+#include <poll.h>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#define INPUTS 1000
+#define THREADS 4
+// long enough to tell that a wait timed out, rather than returned at once.
+#define TIMEOUT_MS 50
+// long enough for any job of this test to end.
+#define DONE_TIMEOUT_MS 10000
+
+static std::atomic<bool> gateOpen(false);
+
+class Vint : public V1 {
+public:
+    explicit Vint(int content) : content(content) { }
+    int content;
+};
+
+class Kint : public K2, public K3 {
+public:
+    explicit Kint(int key) : key(key) { }
+    virtual bool operator<(const K2 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    virtual bool operator<(const K3 &other) const {
+        return key < static_cast<const Kint&>(other).key;
+    }
+    int key;
+};
+
+class gatedClient : public MapReduceClient {
+public:
+    void map(const K1* key, const V1* value, void* context) const {
+        while (!gateOpen) {
+            std::this_thread::yield();
+        }
+        emit2(new Kint(static_cast<const Vint*>(value)->content % 10), nullptr, context);
+    }
+
+    virtual void reduce(const IntermediateVec* pairs, void* context) const {
+        emit3(new Kint(static_cast<const Kint*>(pairs->front().first)->key), nullptr, context);
+        for (const IntermediatePair& pair: *pairs) {
+            delete pair.first;
+        }
+    }
+};
+
+// whether fd becomes readable within timeoutMs.
+bool readable(int fd, int timeoutMs)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+// checks and frees the output, one key per modulo.
+bool checkOutput(OutputVec &outputVec)
+{
+    bool ok = outputVec.size() == 10;
+    for (OutputPair& pair: outputVec) {
+        delete pair.first;
+    }
+    outputVec.clear();
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<Vint> inputs;
+    for (int i = 0; i < INPUTS; i++) {
+        inputs.emplace_back(i);
+    }
+    InputVec inputVec;
+    for (Vint &input: inputs) {
+        inputVec.emplace_back(InputPair({nullptr, &input}));
+    }
+    gatedClient client;
+    OutputVec outputVec;
+
+    JobHandle job = startMapReduceJob(client, inputVec, outputVec, THREADS);
+    int fd = getJobEventFd(job);
+    bool ok = !waitForJobFor(job, TIMEOUT_MS) && !readable(fd, TIMEOUT_MS);
+    printf("running job, wait and event fd time out: %s\n", ok ? "OK" : "FAILED");
+    gateOpen = true;
+    bool doneOk = readable(fd, DONE_TIMEOUT_MS) && waitForJobFor(job, DONE_TIMEOUT_MS);
+    closeJobHandle(job);
+    doneOk = checkOutput(outputVec) && doneOk;
+    printf("job ends, event fd readable and wait returns: %s\n", doneOk ? "OK" : "FAILED");
+
+    job = startMapReduceJob(client, inputVec, outputVec, THREADS);
+    waitForJob(job);
+    bool lateOk = readable(getJobEventFd(job), 0) && waitForJobFor(job, 0);
+    closeJobHandle(job);
+    lateOk = checkOutput(outputVec) && lateOk;
+    printf("event fd asked for once the job is done is readable: %s\n", lateOk ? "OK" : "FAILED");
+    return ok && doneOk && lateOk ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <functional>
 #include <unistd.h>
 #include "MapReduceClient.h"
 #include "MapReduceFramework.h"
@@ -50,6 +51,27 @@ public:
         return this->word < ((Word &) other).word;
     }
 
+    // words compare like their bytes, so they are radix sorted.
+    virtual bool keyBytes(const char *&bytes, std::size_t &size) const
+    {
+        bytes = word.data();
+        size = word.size();
+        return true;
+    }
+
+    // the output is sorted after the job, so words may be counted by hash.
+    virtual bool hash(std::size_t &result) const
+    {
+        result = std::hash<std::string>()(word);
+        return true;
+    }
+
+    virtual bool equals(const K2 &other, bool &result) const
+    {
+        result = this->word == ((Word &) other).word;
+        return true;
+    }
+
     const std::string &getWord()
     {
         return word;
@@ -94,6 +116,18 @@ class MapReduceWordFrequencies : public MapReduceClient
         }
         // delete pairs;
     }
+
+    // words are emitted without values, each one is kept once with its count.
+    virtual bool countOnly() const
+    {
+        return true;
+    }
+
+    virtual void reduceCount(K2 *key, unsigned long count, void *context) const
+    {
+        emit3((Word *) key, new Integer(static_cast<int>(count)), context);
+        usleep(SLEEP_US * 5);
+    }
 };
 
 #endif //OS_EX3_WORDFREQUENCIESCLIENT_HPP